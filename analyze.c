@@ -0,0 +1,272 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* glide64_cache_extract, Glide64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+#include "glide64_cache_extract.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ANALYZE_FORMATS		(GR_TEXFMT_ARGB_CMP_DXT5 + 1)
+#define ANALYZE_DIM_BUCKETS	33
+#define ANALYZE_RATIO_BUCKETS	11
+
+struct format_stats {
+	uint64_t count;
+	uint64_t bytes;
+	uint64_t gz_count;
+	uint64_t gz_bytes;
+	uint64_t raw_bytes;
+};
+
+static struct {
+	uint64_t records;
+	uint64_t unknown;
+	struct format_stats formats[ANALYZE_FORMATS];
+	uint64_t widths[ANALYZE_DIM_BUCKETS];
+	uint64_t heights[ANALYZE_DIM_BUCKETS];
+	uint64_t ratios[ANALYZE_RATIO_BUCKETS];
+	uint64_t hires[2];
+	uint64_t tiled;
+	uint64_t output_count[CONTAINER_DDS + 1];
+	uint64_t output_bytes[CONTAINER_DDS + 1];
+	uint64_t output_estimated[CONTAINER_DDS + 1];
+	uint64_t tar_bytes;
+	uint64_t *checksums;
+	size_t checksums_count;
+	size_t checksums_alloc;
+} analysis;
+
+/* the first bucket only counts broken records without pixels */
+static unsigned int dim_bucket(uint32_t value)
+{
+	unsigned int bucket = 0;
+
+	while (value) {
+		value >>= 1;
+		bucket++;
+	}
+
+	return bucket;
+}
+
+static int add_checksum(uint64_t checksum)
+{
+	uint64_t *checksums;
+	size_t alloc;
+
+	if (analysis.checksums_count == analysis.checksums_alloc) {
+		alloc = analysis.checksums_alloc ? analysis.checksums_alloc * 2 : 4096;
+		checksums = realloc(analysis.checksums, alloc * sizeof(*checksums));
+		if (!checksums) {
+			fprintf(stderr, "Could not allocate memory for checksums\n");
+			return -ENOMEM;
+		}
+
+		analysis.checksums = checksums;
+		analysis.checksums_alloc = alloc;
+	}
+
+	analysis.checksums[analysis.checksums_count++] = checksum;
+
+	return 0;
+}
+
+int analyze_file(struct glide64_file *file __attribute__((unused)))
+{
+	return 0;
+}
+
+/* only the headers are needed: the payload size of compressed records is
+ * stored in the cache and the uncompressed size follows from the format
+ */
+int analyze_finish(struct glide64_file *file, int status __attribute__((unused)))
+{
+	const struct texture_format *fmt;
+	enum texture_container container;
+	struct format_stats *stats;
+	uint16_t format = file->format & ~GR_TEXFMT_GZ;
+	size_t expected_size;
+	size_t output_size;
+	unsigned int bucket;
+
+	free(file->data);
+	file->data = NULL;
+
+	analysis.records++;
+	analysis.widths[dim_bucket(file->width)]++;
+	analysis.heights[dim_bucket(file->height)]++;
+	analysis.hires[file->is_hires_tex ? 1 : 0]++;
+	if (file->tiles)
+		analysis.tiled++;
+
+	if (add_checksum(file->checksum) < 0)
+		return -ENOMEM;
+
+	fmt = texture_format_get(format);
+	if (!fmt) {
+		analysis.unknown++;
+		return 0;
+	}
+
+	expected_size = image_content_length(file);
+	stats = &analysis.formats[format];
+	stats->count++;
+	stats->bytes += file->size;
+	stats->raw_bytes += expected_size;
+
+	if (file->format & GR_TEXFMT_GZ) {
+		stats->gz_count++;
+		stats->gz_bytes += file->size;
+
+		if (expected_size) {
+			bucket = (unsigned int)((uint64_t)file->size * 10 / expected_size);
+			if (bucket >= ANALYZE_RATIO_BUCKETS)
+				bucket = ANALYZE_RATIO_BUCKETS - 1;
+			analysis.ratios[bucket]++;
+		}
+	}
+
+	output_size = output_content_length(file);
+	if (output_size) {
+		container = texture_container_get(fmt);
+		analysis.output_count[container]++;
+		analysis.output_bytes[container] += output_size;
+		if (!output_length_exact(file))
+			analysis.output_estimated[container]++;
+		analysis.tar_bytes += sizeof(tarblock);
+		analysis.tar_bytes += (output_size + sizeof(tarblock) - 1) & ~(sizeof(tarblock) - 1);
+	} else {
+		analysis.output_count[CONTAINER_NONE]++;
+	}
+
+	return 0;
+}
+
+static int compare_checksum(const void *a, const void *b)
+{
+	uint64_t checksum_a = *(const uint64_t *)a;
+	uint64_t checksum_b = *(const uint64_t *)b;
+
+	if (checksum_a < checksum_b)
+		return -1;
+	if (checksum_a > checksum_b)
+		return 1;
+
+	return 0;
+}
+
+static void print_histogram(FILE *out, const char *title, const uint64_t *buckets)
+{
+	unsigned int i;
+
+	fprintf(out, "%s:\n", title);
+	for (i = 0; i < ANALYZE_DIM_BUCKETS; i++) {
+		if (!buckets[i])
+			continue;
+
+		if (i == 0)
+			fprintf(out, "\t%10u - %10u: %"PRIu64"\n", 0U, 0U, buckets[i]);
+		else
+			fprintf(out, "\t%10"PRIu64" - %10"PRIu64": %"PRIu64"\n",
+				(uint64_t)1 << (i - 1), ((uint64_t)1 << i) - 1, buckets[i]);
+	}
+	fprintf(out, "\n");
+}
+
+/* sizes which depend on the pixels are only reported as upper bound */
+static void print_output(FILE *out, const char *name, enum texture_container container)
+{
+	uint64_t estimated = analysis.output_estimated[container];
+
+	fprintf(out, "\t%s: %"PRIu64" files, %s%"PRIu64" bytes", name,
+		analysis.output_count[container], estimated ? "at most " : "",
+		analysis.output_bytes[container]);
+	if (estimated)
+		fprintf(out, " (%"PRIu64" estimated)", estimated);
+	fprintf(out, "\n");
+}
+
+int analyze_report(void)
+{
+	const struct texture_format *fmt;
+	struct format_stats *stats;
+	uint64_t duplicates = 0;
+	uint64_t duplicated = 0;
+	FILE *out = globals.out;
+	size_t i, run;
+
+	fprintf(out, "Records: %"PRIu64"\n", analysis.records);
+	fprintf(out, "Hires textures: %"PRIu64"\n", analysis.hires[1]);
+	fprintf(out, "Other textures: %"PRIu64"\n", analysis.hires[0]);
+	fprintf(out, "Tiled textures: %"PRIu64"\n", analysis.tiled);
+	fprintf(out, "Unknown formats: %"PRIu64"\n", analysis.unknown);
+	fprintf(out, "\n");
+
+	fprintf(out, "Formats:\n");
+	fprintf(out, "\t%-20s %10s %14s %10s %14s %14s\n", "format", "count",
+		"bytes", "gz count", "gz bytes", "raw bytes");
+	for (i = 0; i < ANALYZE_FORMATS; i++) {
+		stats = &analysis.formats[i];
+		if (!stats->count)
+			continue;
+
+		fmt = texture_format_get((uint16_t)i);
+		fprintf(out, "\t%-20s %10"PRIu64" %14"PRIu64" %10"PRIu64" %14"PRIu64" %14"PRIu64"\n",
+			fmt->name, stats->count, stats->bytes, stats->gz_count,
+			stats->gz_bytes, stats->raw_bytes);
+	}
+	fprintf(out, "\n");
+
+	print_histogram(out, "Width", analysis.widths);
+	print_histogram(out, "Height", analysis.heights);
+
+	fprintf(out, "Compression ratio of GR_TEXFMT_GZ records:\n");
+	for (i = 0; i < ANALYZE_RATIO_BUCKETS; i++) {
+		if (i == ANALYZE_RATIO_BUCKETS - 1)
+			fprintf(out, "\t  >=%3zu%%: %"PRIu64"\n", i * 10, analysis.ratios[i]);
+		else
+			fprintf(out, "\t%3zu-%3zu%%: %"PRIu64"\n", i * 10, i * 10 + 9, analysis.ratios[i]);
+	}
+	fprintf(out, "\n");
+
+	qsort(analysis.checksums, analysis.checksums_count,
+	      sizeof(*analysis.checksums), compare_checksum);
+	for (i = 0; i < analysis.checksums_count; i += run) {
+		for (run = 1; i + run < analysis.checksums_count; run++) {
+			if (analysis.checksums[i + run] != analysis.checksums[i])
+				break;
+		}
+
+		if (run > 1) {
+			duplicated++;
+			duplicates += run - 1;
+		}
+	}
+	fprintf(out, "Duplicate checksums: %"PRIu64" (%"PRIu64" extra records)\n",
+		duplicated, duplicates);
+	fprintf(out, "\n");
+
+	fprintf(out, "Projected output:\n");
+	print_output(out, "bmp", CONTAINER_BMP);
+	print_output(out, "dds", CONTAINER_DDS);
+	fprintf(out, "\tunsupported: %"PRIu64" records\n",
+		analysis.output_count[CONTAINER_NONE]);
+	fprintf(out, "\ttar: %s%"PRIu64" bytes\n",
+		analysis.output_estimated[CONTAINER_BMP] || analysis.output_estimated[CONTAINER_DDS] ?
+		"at most " : "", analysis.tar_bytes + 2 * sizeof(tarblock));
+
+	free(analysis.checksums);
+	analysis.checksums = NULL;
+
+	if (fflush(out) != 0)
+		return -EIO;
+
+	return 0;
+}
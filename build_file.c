@@ -0,0 +1,490 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* glide64_cache_extract, Glide64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+#include "glide64_cache_extract.h"
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+/* The cache builder is the reverse of the extraction. Images named like the
+ * extracted files are read from directories or tars and the checksum is
+ * taken from their name. The workers decode, convert and compress them and
+ * the records are written in the order of the input.
+ */
+
+#pragma pack(push, 1)
+struct cache_record_header {
+	uint64_t checksum;
+	uint32_t width;
+	uint32_t height;
+	uint16_t format;
+	uint32_t smallLodLog2;
+	uint32_t largeLodLog2;
+	uint32_t aspectRatioLog2;
+	uint32_t tiles;
+	uint32_t untiled_width;
+	uint32_t untiled_height;
+	uint8_t is_hires_tex;
+	uint32_t size;
+};
+#pragma pack(pop)
+
+static struct {
+	uint64_t skipped;
+	uint64_t failed;
+} build;
+
+/* the name is either PREFIX#CRC#3#0_all.ext or
+ * PREFIX#CRC#3#0#PALETTECRC_ciByRGBA.ext
+ */
+static int parse_checksum(const char *path, uint64_t *checksum)
+{
+	const char *name, *ext, *pos;
+	uint32_t low, high;
+	int len;
+
+	name = strrchr(path, '/');
+	name = name ? name + 1 : path;
+
+	ext = strrchr(name, '.');
+	if (!ext)
+		return -EINVAL;
+
+	/* the prefix may contain '#' as well */
+	for (pos = strchr(name, '#'); pos; pos = strchr(pos + 1, '#')) {
+		len = 0;
+		if (sscanf(pos, "#%8"SCNx32"#%*x#%*x_all.%n", &low, &len) == 1 &&
+		    pos + len == ext + 1) {
+			*checksum = low;
+			return 0;
+		}
+
+		len = 0;
+		if (sscanf(pos, "#%8"SCNx32"#%*x#%*x#%8"SCNx32"_ciByRGBA.%n",
+			   &low, &high, &len) == 2 &&
+		    pos + len == ext + 1) {
+			*checksum = (uint64_t)high << 32 | low;
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+static uint32_t lod_log2(uint32_t value)
+{
+	uint32_t log2 = 0;
+
+	while (value >>= 1)
+		log2++;
+
+	return log2;
+}
+
+int build_file(struct glide64_file *file)
+{
+	uint32_t gz_flag = globals.type == INPUT_TEX ? GZ_TEXCACHE : GZ_HIRESTEXCACHE;
+	uLongf destLen;
+	void *buf;
+	int ret;
+
+	ret = decode_image(file);
+	if (ret < 0) {
+		fprintf(stderr, "Unsupported image for checksum %016"PRIX64"\n",
+			file->checksum);
+		return ret;
+	}
+
+	ret = pack_file(file, globals.build_format);
+	if (ret < 0)
+		return ret;
+
+	/* computed like Glide64 does for loaded hires textures */
+	if (file->width >= file->height) {
+		file->largeLodLog2 = lod_log2(file->width);
+		file->aspectRatioLog2 = lod_log2(file->width / file->height);
+	} else {
+		file->largeLodLog2 = lod_log2(file->height);
+		file->aspectRatioLog2 = (uint32_t)-(int32_t)lod_log2(file->height / file->width);
+	}
+	file->smallLodLog2 = file->largeLodLog2;
+	file->is_hires_tex = globals.type != INPUT_TEX;
+
+	if (globals.build_config & gz_flag) {
+		destLen = compressBound(file->size);
+		buf = malloc(destLen);
+		if (!buf) {
+			fprintf(stderr, "Memory for compressing the file couldn't be allocated\n");
+			return -ENOMEM;
+		}
+
+		ret = compress2(buf, &destLen, file->data, file->size,
+				Z_DEFAULT_COMPRESSION);
+		if (ret != Z_OK) {
+			free(buf);
+			fprintf(stderr, "Failure during compressing\n");
+			return -EINVAL;
+		}
+
+		free(file->data);
+		file->data = buf;
+		file->size = (uint32_t)destLen;
+		file->format |= GR_TEXFMT_GZ;
+	}
+
+	file->cache_width = file->width;
+	file->cache_height = file->height;
+	file->cache_format = file->format;
+	file->cache_size = file->size;
+
+	return 0;
+}
+
+int build_finish(struct glide64_file *file, int status)
+{
+	struct cache_record_header header;
+	int ret;
+
+	if (status < 0) {
+		free(file->data);
+		build.failed++;
+		metadata_file(file, NULL, "failed");
+		fprintf(stderr, "Failed to build record for checksum %016"PRIX64"\n",
+			file->checksum);
+		return globals.ignore_error ? 0 : status;
+	}
+
+	header.checksum = htole64(file->checksum);
+	header.width = htole32(file->width);
+	header.height = htole32(file->height);
+	header.format = htole16(file->format);
+	header.smallLodLog2 = htole32(file->smallLodLog2);
+	header.largeLodLog2 = htole32(file->largeLodLog2);
+	header.aspectRatioLog2 = htole32(file->aspectRatioLog2);
+	header.tiles = htole32(file->tiles);
+	header.untiled_width = htole32(file->untiled_width);
+	header.untiled_height = htole32(file->untiled_height);
+	header.is_hires_tex = file->is_hires_tex;
+	header.size = htole32(file->size);
+
+	ret = output_write(&header, sizeof(header));
+	if (ret == 0)
+		ret = output_write(file->data, file->size);
+	free(file->data);
+	if (ret < 0) {
+		fprintf(stderr, "Could not write record\n");
+		return -EIO;
+	}
+
+	metadata_file(file, NULL, "ok");
+
+	return 0;
+}
+
+static int build_submit(uint64_t checksum, void *data, size_t size)
+{
+	struct glide64_file file;
+
+	if (size > UINT32_MAX) {
+		free(data);
+		fprintf(stderr, "Too large image for checksum %016"PRIX64"\n", checksum);
+		return -EINVAL;
+	}
+
+	memset(&file, 0, sizeof(file));
+	file.checksum = checksum;
+	file.data = data;
+	file.size = (uint32_t)size;
+	file.prefix = globals.prefix;
+
+	progress_add(&progress.bytes_in, size);
+
+	return pipeline_submit(&file);
+}
+
+static int read_payload(FILE *in, void *buffer, uint64_t size)
+{
+	if (fread(buffer, 1, size, in) != size) {
+		fprintf(stderr, "File stream ended to early\n");
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static int build_path(const char *path, uint64_t checksum)
+{
+	struct stat st;
+	void *data;
+	FILE *f;
+	int ret;
+
+	f = fopen(path, "rb");
+	if (!f || fstat(fileno(f), &st) < 0 || !S_ISREG(st.st_mode)) {
+		if (f)
+			fclose(f);
+		fprintf(stderr, "Could not open image %s\n", path);
+		return -ENOENT;
+	}
+
+	data = malloc(st.st_size ? (size_t)st.st_size : 1);
+	if (!data) {
+		fclose(f);
+		fprintf(stderr, "Could not allocate memory for image %s\n", path);
+		return -ENOMEM;
+	}
+
+	ret = read_payload(f, data, (uint64_t)st.st_size);
+	fclose(f);
+	if (ret < 0) {
+		free(data);
+		return ret;
+	}
+
+	return build_submit(checksum, data, (size_t)st.st_size);
+}
+
+static void build_skip(const char *name)
+{
+	build.skipped++;
+
+	if (globals.verbose >= VERBOSITY_GLOBAL_HEADER)
+		fprintf(stderr, "Skipping %s without checksum in its name\n", name);
+}
+
+static int skip_payload(FILE *in, uint64_t size)
+{
+	uint8_t block[sizeof(tarblock)];
+	size_t len;
+
+	while (size) {
+		len = size < sizeof(block) ? (size_t)size : sizeof(block);
+		if (read_payload(in, block, len) < 0)
+			return -EIO;
+		size -= len;
+	}
+
+	return 0;
+}
+
+static int build_tar(FILE *in, const char *dir)
+{
+	struct tar_header header;
+	uint8_t block[sizeof(tarblock)];
+	char name[sizeof(header.name) + 1];
+	char linkname[sizeof(header.linkname) + 1];
+	char size[sizeof(header.size) + 1];
+	uint64_t checksum;
+	uint64_t padded;
+	char *path;
+	void *data;
+	size_t len;
+	int ret;
+
+	while (1) {
+		ret = read_payload(in, block, sizeof(block));
+		if (ret < 0)
+			return ret;
+
+		/* the archive ends with empty blocks */
+		if (memcmp(block, tarblock, sizeof(block)) == 0)
+			return 0;
+
+		memcpy(&header, block, sizeof(header));
+		memcpy(name, header.name, sizeof(header.name));
+		name[sizeof(header.name)] = '\0';
+		memcpy(size, header.size, sizeof(header.size));
+		size[sizeof(header.size)] = '\0';
+
+		len = strtoull(size, NULL, 8);
+		padded = ((uint64_t)len + sizeof(block) - 1) & ~(uint64_t)(sizeof(block) - 1);
+
+		if ((header.link != '\0' && header.link != '0' && header.link != '2') ||
+		    parse_checksum(name, &checksum) < 0) {
+			if (header.link != '5')
+				build_skip(name);
+
+			ret = skip_payload(in, padded);
+			if (ret < 0)
+				return ret;
+			continue;
+		}
+
+		/* links into a --store point to the content */
+		if (header.link == '2') {
+			memcpy(linkname, header.linkname, sizeof(header.linkname));
+			linkname[sizeof(header.linkname)] = '\0';
+
+			ret = skip_payload(in, padded);
+			if (ret < 0)
+				return ret;
+
+			if (linkname[0] == '/') {
+				ret = build_path(linkname, checksum);
+			} else {
+				len = strlen(dir) + 1 + strlen(linkname) + 1;
+				path = malloc(len);
+				if (!path)
+					return -ENOMEM;
+
+				snprintf(path, len, "%s/%s", dir, linkname);
+				ret = build_path(path, checksum);
+				free(path);
+			}
+
+			if (ret < 0)
+				return ret;
+			continue;
+		}
+
+		data = malloc(len ? len : 1);
+		if (!data) {
+			fprintf(stderr, "Could not allocate memory for image %s\n", name);
+			return -ENOMEM;
+		}
+
+		ret = read_payload(in, data, len);
+		if (ret == 0)
+			ret = skip_payload(in, padded - len);
+		if (ret < 0) {
+			free(data);
+			return ret;
+		}
+
+		ret = build_submit(checksum, data, len);
+		if (ret < 0)
+			return ret;
+	}
+}
+
+static int build_directory(const char *path)
+{
+	struct dirent **entries;
+	uint64_t checksum;
+	struct stat st;
+	char *entry_path;
+	size_t len;
+	int count;
+	int ret = 0;
+	int i;
+
+	count = scandir(path, &entries, NULL, alphasort);
+	if (count < 0) {
+		fprintf(stderr, "Could not read directory %s\n", path);
+		return -ENOENT;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (ret < 0 || entries[i]->d_name[0] == '.')
+			goto next;
+
+		len = strlen(path) + 1 + strlen(entries[i]->d_name) + 1;
+		entry_path = malloc(len);
+		if (!entry_path) {
+			ret = -ENOMEM;
+			goto next;
+		}
+
+		snprintf(entry_path, len, "%s/%s", path, entries[i]->d_name);
+		if (stat(entry_path, &st) == 0 && S_ISREG(st.st_mode)) {
+			if (parse_checksum(entries[i]->d_name, &checksum) == 0)
+				ret = build_path(entry_path, checksum);
+			else
+				build_skip(entries[i]->d_name);
+		}
+		free(entry_path);
+
+next:
+		free(entries[i]);
+	}
+	free(entries);
+
+	return ret;
+}
+
+static int build_input(const char *path)
+{
+	struct stat st;
+	char *dir, *slash;
+	FILE *f;
+	int ret;
+
+	if (stat(path, &st) == 0 && S_ISDIR(st.st_mode))
+		return build_directory(path);
+
+	f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "Could not open input file %s\n", path);
+		return -ENOENT;
+	}
+
+	/* relative links are resolved next to the tar */
+	dir = strdup(path);
+	if (!dir) {
+		fclose(f);
+		return -ENOMEM;
+	}
+
+	slash = strrchr(dir, '/');
+	if (slash)
+		*slash = '\0';
+	else
+		strcpy(dir, ".");
+
+	ret = build_tar(f, dir);
+	free(dir);
+	fclose(f);
+
+	return ret;
+}
+
+int build_cache(int count, char *paths[])
+{
+	uint32_t config = htole32(globals.build_config);
+	int ret;
+	int i;
+
+	ret = parse_config(globals.build_config);
+	if (ret < 0)
+		return ret;
+
+	metadata_config(globals.build_config);
+
+	ret = output_write(&config, sizeof(config));
+	if (ret < 0) {
+		fprintf(stderr, "Could not write config header\n");
+		return ret;
+	}
+
+	/* a tar given via stdin or --input */
+	if (!count)
+		ret = build_tar(globals.in, ".");
+
+	for (i = 0; i < count && ret >= 0; i++)
+		ret = build_input(paths[i]);
+
+	if (ret < 0) {
+		pipeline_discard();
+		return ret;
+	}
+
+	ret = pipeline_flush();
+	if (ret < 0)
+		return ret;
+
+	if (globals.verbose >= VERBOSITY_GLOBAL_HEADER)
+		fprintf(stderr, "Skipped %"PRIu64" files without checksum and %"PRIu64" unsupported images\n",
+			build.skipped, build.failed);
+
+	return 0;
+}
@@ -0,0 +1,239 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* glide64_cache_extract, Glide64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+#include "glide64_cache_extract.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/* A checkpoint is only written after the output was synced to disk. It
+ * points to the first record which was not yet written and to the end of
+ * the last tar entry in front of it. Everything behind it is discarded on
+ * resume.
+ */
+
+#define CHECKPOINT_INTERVAL	(256 * 1024 * 1024)
+
+static struct {
+	char *path;
+	char *tmppath;
+	int valid;
+	uint64_t input_size;
+	uint64_t input_offset;
+	uint64_t records;
+	uint64_t output_offset;
+	uint64_t metadata_offset;
+	uint64_t last_sync;
+} checkpoint;
+
+static int checkpoint_load(void)
+{
+	FILE *f;
+	int ret;
+
+	f = fopen(checkpoint.path, "r");
+	if (!f)
+		return 0;
+
+	ret = fscanf(f, "input_size %"SCNu64"\ninput_offset %"SCNu64"\nrecords %"SCNu64"\noutput_offset %"SCNu64"\nmetadata_offset %"SCNu64"\n",
+		     &checkpoint.input_size, &checkpoint.input_offset,
+		     &checkpoint.records, &checkpoint.output_offset,
+		     &checkpoint.metadata_offset);
+	fclose(f);
+
+	if (ret != 5 || checkpoint.output_offset % sizeof(tarblock) != 0) {
+		fprintf(stderr, "Invalid checkpoint file %s\n", checkpoint.path);
+		return -EINVAL;
+	}
+
+	checkpoint.valid = 1;
+
+	return 0;
+}
+
+int checkpoint_open(const char *output)
+{
+	struct stat st;
+	size_t len;
+	int ret;
+
+	if (fstat(fileno(globals.in), &st) < 0 || !S_ISREG(st.st_mode) ||
+	    fstat(fileno(globals.out), &st) < 0 || !S_ISREG(st.st_mode)) {
+		fprintf(stderr, "--resume requires regular input and output files\n");
+		return -EINVAL;
+	}
+
+	len = strlen(output) + sizeof(".checkpoint.tmp");
+	checkpoint.path = malloc(len);
+	checkpoint.tmppath = malloc(len);
+	if (!checkpoint.path || !checkpoint.tmppath) {
+		fprintf(stderr, "Could not allocate checkpoint path\n");
+		return -ENOMEM;
+	}
+
+	snprintf(checkpoint.path, len, "%s.checkpoint", output);
+	snprintf(checkpoint.tmppath, len, "%s.checkpoint.tmp", output);
+
+	ret = checkpoint_load();
+	if (ret < 0)
+		return ret;
+
+	if (fstat(fileno(globals.in), &st) < 0)
+		return -EIO;
+
+	if (!checkpoint.valid) {
+		checkpoint.input_size = (uint64_t)st.st_size;
+		return 0;
+	}
+
+	if ((uint64_t)st.st_size != checkpoint.input_size) {
+		fprintf(stderr, "Checkpoint %s was created for a different input\n",
+			checkpoint.path);
+		return -EINVAL;
+	}
+
+	if (fstat(fileno(globals.out), &st) < 0 ||
+	    (uint64_t)st.st_size < checkpoint.output_offset) {
+		fprintf(stderr, "Output is shorter than the checkpoint %s\n",
+			checkpoint.path);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/* the metadata written in front of the checkpoint is kept on resume */
+int64_t checkpoint_metadata_offset(void)
+{
+	if (!checkpoint.valid)
+		return -1;
+
+	return (int64_t)checkpoint.metadata_offset;
+}
+
+int checkpoint_restore_output(void)
+{
+	int fd = fileno(globals.out);
+
+	if (!checkpoint.valid) {
+		/* a fresh start must not keep the content of an old output */
+		if (ftruncate(fd, 0) < 0 || fseeko(globals.out, 0, SEEK_SET) < 0)
+			return -EIO;
+
+		return 0;
+	}
+
+	if (ftruncate(fd, (off_t)checkpoint.output_offset) < 0 ||
+	    fseeko(globals.out, (off_t)checkpoint.output_offset, SEEK_SET) < 0) {
+		fprintf(stderr, "Could not truncate output to checkpoint\n");
+		return -EIO;
+	}
+
+	checkpoint.last_sync = checkpoint.output_offset;
+
+	return 0;
+}
+
+int checkpoint_restore_input(void)
+{
+	if (!checkpoint.valid)
+		return 0;
+
+	if (fseeko(globals.in, (off_t)checkpoint.input_offset, SEEK_SET) < 0) {
+		fprintf(stderr, "Could not seek input to checkpoint\n");
+		return -EIO;
+	}
+
+	progress_add(&progress.bytes_in, checkpoint.input_offset - globals.in_offset);
+	globals.in_offset = checkpoint.input_offset;
+
+	if (globals.verbose >= VERBOSITY_GLOBAL_HEADER)
+		fprintf(stderr, "Resuming after %"PRIu64" records at input offset %#"PRIx64"\n",
+			checkpoint.records, checkpoint.input_offset);
+
+	return 0;
+}
+
+static int checkpoint_write(void)
+{
+	FILE *f;
+	int ret = 0;
+
+	f = fopen(checkpoint.tmppath, "w");
+	if (!f) {
+		fprintf(stderr, "Could not open checkpoint file %s\n", checkpoint.tmppath);
+		return -EIO;
+	}
+
+	fprintf(f, "input_size %"PRIu64"\ninput_offset %"PRIu64"\nrecords %"PRIu64"\noutput_offset %"PRIu64"\nmetadata_offset %"PRIu64"\n",
+		checkpoint.input_size, checkpoint.input_offset,
+		checkpoint.records, checkpoint.output_offset,
+		checkpoint.metadata_offset);
+
+	if (fflush(f) != 0 || fsync(fileno(f)) < 0)
+		ret = -EIO;
+	if (fclose(f) != 0)
+		ret = -EIO;
+
+	if (ret == 0 && rename(checkpoint.tmppath, checkpoint.path) < 0)
+		ret = -EIO;
+
+	if (ret < 0) {
+		fprintf(stderr, "Could not write checkpoint file %s\n", checkpoint.path);
+		unlink(checkpoint.tmppath);
+	}
+
+	return ret;
+}
+
+int checkpoint_update(const struct glide64_file *file)
+{
+	uint64_t offset;
+	int ret;
+
+	if (!checkpoint.path)
+		return 0;
+
+	checkpoint.records++;
+	checkpoint.input_offset = file->offset + file->record_size;
+
+	offset = output_tell();
+	if (offset - checkpoint.last_sync < CHECKPOINT_INTERVAL)
+		return 0;
+
+	ret = output_sync();
+	if (ret < 0) {
+		fprintf(stderr, "Could not sync output for checkpoint\n");
+		return ret;
+	}
+
+	ret = metadata_sync(&checkpoint.metadata_offset);
+	if (ret < 0)
+		return ret;
+
+	checkpoint.output_offset = offset;
+	checkpoint.last_sync = offset;
+
+	return checkpoint_write();
+}
+
+void checkpoint_close(int success)
+{
+	if (checkpoint.path && success)
+		unlink(checkpoint.path);
+
+	free(checkpoint.tmppath);
+	free(checkpoint.path);
+	checkpoint.tmppath = NULL;
+	checkpoint.path = NULL;
+}
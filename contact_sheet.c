@@ -0,0 +1,349 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* glide64_cache_extract, Glide64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+#include "glide64_cache_extract.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* The workers decode and downscale each texture to a thumbnail. The
+ * thumbnails are placed on the current sheet in the order of the input and
+ * a sheet is written as soon as all of its tiles are used. An index maps the
+ * checksum of each texture to its sheet and position.
+ */
+
+#define SHEET_COLUMNS	32
+#define SHEET_ROWS	32
+
+static struct {
+	uint32_t *pixels;
+	unsigned int number;
+	unsigned int tiles;
+	char name[64];
+
+	char *index;
+	size_t index_len;
+	size_t index_alloc;
+	uint64_t skipped;
+} sheet;
+
+#ifdef __SSE2__
+
+/* sum of 4 pixels per iteration, each channel in its own 32 bit lane */
+static __m128i box_sum_row(const uint32_t *src, size_t count, __m128i sum)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i pixels, lo, hi;
+	size_t i = 0;
+
+	for (; i + 4 <= count; i += 4) {
+		pixels = _mm_loadu_si128((const __m128i *)&src[i]);
+		lo = _mm_unpacklo_epi8(pixels, zero);
+		hi = _mm_unpackhi_epi8(pixels, zero);
+		lo = _mm_add_epi16(lo, hi);
+		sum = _mm_add_epi32(sum, _mm_unpacklo_epi16(lo, zero));
+		sum = _mm_add_epi32(sum, _mm_unpackhi_epi16(lo, zero));
+	}
+
+	for (; i < count; i++) {
+		pixels = _mm_cvtsi32_si128((int)src[i]);
+		pixels = _mm_unpacklo_epi8(pixels, zero);
+		sum = _mm_add_epi32(sum, _mm_unpacklo_epi16(pixels, zero));
+	}
+
+	return sum;
+}
+
+static uint32_t box_filter(const uint32_t *src, size_t stride, size_t x0,
+			   size_t x1, size_t y0, size_t y1)
+{
+	__m128i sum = _mm_setzero_si128();
+	uint32_t channels[4];
+	uint32_t count = (uint32_t)((x1 - x0) * (y1 - y0));
+	uint32_t pixel = 0;
+	size_t y;
+	int c;
+
+	for (y = y0; y < y1; y++)
+		sum = box_sum_row(&src[y * stride + x0], x1 - x0, sum);
+
+	_mm_storeu_si128((__m128i *)channels, sum);
+	for (c = 0; c < 4; c++)
+		pixel |= ((channels[c] + count / 2) / count) << (c * 8);
+
+	return pixel;
+}
+
+#else
+
+static uint32_t box_filter(const uint32_t *src, size_t stride, size_t x0,
+			   size_t x1, size_t y0, size_t y1)
+{
+	uint32_t channels[4] = { 0 };
+	uint32_t count = (uint32_t)((x1 - x0) * (y1 - y0));
+	const uint8_t *pos;
+	uint32_t pixel = 0;
+	size_t x, y;
+	int c;
+
+	for (y = y0; y < y1; y++) {
+		for (x = x0; x < x1; x++) {
+			pos = (const uint8_t *)&src[y * stride + x];
+			for (c = 0; c < 4; c++)
+				channels[c] += pos[c];
+		}
+	}
+
+	for (c = 0; c < 4; c++)
+		pixel |= ((channels[c] + count / 2) / count) << (c * 8);
+
+	return pixel;
+}
+
+#endif
+
+static int downscale_image(struct glide64_file *file)
+{
+	const uint32_t *src = file->data;
+	uint32_t width = file->width;
+	uint32_t height = file->height;
+	uint32_t longest = width > height ? width : height;
+	uint32_t size = globals.sheet_tile;
+	uint32_t tw, th, x, y;
+	uint32_t *dst;
+
+	if (!width || !height)
+		return -EINVAL;
+
+	if (longest <= size)
+		return 0;
+
+	tw = (uint32_t)((uint64_t)width * size / longest);
+	th = (uint32_t)((uint64_t)height * size / longest);
+	if (!tw)
+		tw = 1;
+	if (!th)
+		th = 1;
+
+	dst = malloc((size_t)tw * th * 4);
+	if (!dst)
+		return -ENOMEM;
+
+	/* each thumbnail pixel is the average of the source pixels it covers */
+	for (y = 0; y < th; y++) {
+		size_t y0 = (uint64_t)y * height / th;
+		size_t y1 = (uint64_t)(y + 1) * height / th;
+
+		for (x = 0; x < tw; x++) {
+			size_t x0 = (uint64_t)x * width / tw;
+			size_t x1 = (uint64_t)(x + 1) * width / tw;
+
+			dst[y * tw + x] = box_filter(src, width, x0, x1, y0, y1);
+		}
+	}
+
+	free(file->data);
+	file->data = dst;
+	file->width = tw;
+	file->height = th;
+	file->size = tw * th * 4;
+
+	return 0;
+}
+
+int sheet_file(struct glide64_file *file)
+{
+	int ret;
+
+	ret = normalize_file(file);
+	if (ret < 0)
+		return ret;
+
+	return downscale_image(file);
+}
+
+static int index_append(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static int index_append(const char *fmt, ...)
+{
+	va_list ap;
+	size_t alloc;
+	char *tmp;
+	int len;
+
+	while (1) {
+		va_start(ap, fmt);
+		len = vsnprintf(sheet.index + sheet.index_len,
+				sheet.index_alloc - sheet.index_len, fmt, ap);
+		va_end(ap);
+
+		if (len < 0)
+			return -EINVAL;
+
+		if ((size_t)len < sheet.index_alloc - sheet.index_len)
+			break;
+
+		alloc = sheet.index_alloc ? sheet.index_alloc * 2 : 64 * 1024;
+		tmp = realloc(sheet.index, alloc);
+		if (!tmp) {
+			fprintf(stderr, "Could not allocate memory for contact sheet index\n");
+			return -ENOMEM;
+		}
+
+		sheet.index = tmp;
+		sheet.index_alloc = alloc;
+	}
+
+	sheet.index_len += (size_t)len;
+
+	return 0;
+}
+
+static int sheet_write(void)
+{
+	struct glide64_file file;
+	uint32_t size = globals.sheet_tile;
+	int ret;
+
+	memset(&file, 0, sizeof(file));
+	file.name = sheet.name;
+	file.format = GR_TEXFMT_ARGB_8888;
+	file.width = SHEET_COLUMNS * size;
+	file.height = ((sheet.tiles + SHEET_COLUMNS - 1) / SHEET_COLUMNS) * size;
+	file.size = file.width * file.height * 4;
+	file.data = sheet.pixels;
+	sheet.pixels = NULL;
+	sheet.tiles = 0;
+	sheet.number++;
+
+	ret = wrap_bitmap(&file);
+	if (ret < 0) {
+		free(file.data);
+		return ret;
+	}
+
+	ret = write_file(&file);
+	free(file.data);
+
+	return ret;
+}
+
+int sheet_finish(struct glide64_file *file, int status)
+{
+	uint32_t size = globals.sheet_tile;
+	const uint32_t *src = file->data;
+	uint32_t col, row, x, y, i;
+	uint32_t *dst;
+	int ret;
+
+	/* formats which cannot be normalized are left out of the sheets */
+	if (status == -EPERM) {
+		free(file->data);
+		sheet.skipped++;
+		metadata_file(file, NULL, "skipped");
+		return 0;
+	}
+
+	if (status < 0) {
+		free(file->data);
+		metadata_file(file, NULL, "failed");
+		fprintf(stderr, "Failed to prepare thumbnail\n");
+		if (globals.ignore_error)
+			return 0;
+		else
+			return status;
+	}
+
+	if (!sheet.pixels) {
+		sheet.pixels = calloc((size_t)SHEET_COLUMNS * SHEET_ROWS * size * size, 4);
+		if (!sheet.pixels) {
+			free(file->data);
+			fprintf(stderr, "Could not allocate memory for contact sheet\n");
+			return -ENOMEM;
+		}
+
+		snprintf(sheet.name, sizeof(sheet.name), "contact_sheet_%04u.bmp",
+			 sheet.number);
+	}
+
+	col = sheet.tiles % SHEET_COLUMNS;
+	row = sheet.tiles / SHEET_COLUMNS;
+
+	/* thumbnails are centered in their tile */
+	x = col * size + (size - file->width) / 2;
+	y = row * size + (size - file->height) / 2;
+	dst = sheet.pixels + (size_t)y * SHEET_COLUMNS * size + x;
+	for (i = 0; i < file->height; i++)
+		memcpy(&dst[(size_t)i * SHEET_COLUMNS * size], &src[(size_t)i * file->width],
+		       (size_t)file->width * 4);
+
+	free(file->data);
+	file->data = NULL;
+
+	ret = index_append("%s\t%"PRIu32"\t%"PRIu32"\t%"PRIu32"\t%"PRIu32"\t%s\t%016"PRIX64"\n",
+			   sheet.name, x, y, file->width, file->height,
+			   file->prefix ? file->prefix : "", file->checksum);
+	if (ret < 0)
+		return ret;
+
+	metadata_file(file, sheet.name, "ok");
+
+	sheet.tiles++;
+	if (sheet.tiles == SHEET_COLUMNS * SHEET_ROWS)
+		return sheet_write();
+
+	return 0;
+}
+
+/* write the last partially filled sheet and the index of all sheets */
+int sheet_flush(void)
+{
+	struct glide64_file file;
+	int ret;
+
+	if (sheet.tiles) {
+		ret = sheet_write();
+		if (ret < 0)
+			return ret;
+	}
+
+	if (sheet.skipped && globals.verbose >= VERBOSITY_GLOBAL_HEADER)
+		fprintf(stderr, "Skipped %"PRIu64" textures which could not be decoded\n",
+			sheet.skipped);
+
+	memset(&file, 0, sizeof(file));
+	file.name = "contact_sheet.txt";
+	file.data = sheet.index;
+	file.size = (uint32_t)sheet.index_len;
+	memset(&sheet, 0, sizeof(sheet));
+
+	ret = 0;
+	if (globals.archive != ARCHIVE_TAR)
+		ret = zip_prepare(&file);
+
+	if (ret >= 0)
+		ret = write_file(&file);
+	free(file.data);
+
+	return ret;
+}
+
+/* drop the sheet and the index of an output which is not completed */
+void sheet_abort(void)
+{
+	free(sheet.pixels);
+	free(sheet.index);
+	memset(&sheet, 0, sizeof(sheet));
+}
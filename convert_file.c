@@ -7,11 +7,13 @@
 #include "glide64_cache_extract.h"
 #include <errno.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <zlib.h>
 
 #define DDSD_CAPS		0x00000001U
@@ -22,9 +24,10 @@
 #define DDSD_LINEARSIZE		0x00080000U
 
 #define DDPF_ALPHAPIXELS	0x00000001U
+#define DDPF_ALPHA		0x00000002U
 #define DDPF_FOURCC		0x00000004U
 #define DDPF_RGB		0x00000040U
-#define DDPF_LUMINANCE		0x00000040U
+#define DDPF_LUMINANCE		0x00020000U
 
 #define DDSCAPS_TEXTURE		0x00001000U
 
@@ -116,54 +119,50 @@ struct bmp_header_v5 {
 };
 #pragma pack(pop)
 
-static size_t image_content_length(const struct glide64_file *file)
+size_t image_content_length(const struct glide64_file *file)
 {
-#define BALIGN(x, a) (((x) + (a)) & ~(a))
+#define DIV_ROUND_UP(x, d) (((size_t)(x) + (d) - 1) / (d))
+	const struct texture_format *fmt;
 	size_t size;
 
-	switch (file->format & ~GR_TEXFMT_GZ) {
-	case GR_TEXFMT_ALPHA_8:
-	case GR_TEXFMT_INTENSITY_8:
-	case GR_TEXFMT_ALPHA_INTENSITY_44:
-	case GR_TEXFMT_P_8:
-		size = file->width * file->height;
-		break;
-	case GR_TEXFMT_RGB_565:
-	case GR_TEXFMT_ARGB_1555:
-	case GR_TEXFMT_ARGB_4444:
-	case GR_TEXFMT_ALPHA_INTENSITY_88:
-		size = file->width * file->height * 2;
-		break;
-	case GR_TEXFMT_ARGB_CMP_FXT1:
-		size = (BALIGN(file->width, 7U) * BALIGN(file->height, 3U)) / 2;
-		break;
-	case GR_TEXFMT_ARGB_8888:
-		size = file->width * file->height * 4;
-		break;
-	case GR_TEXFMT_ARGB_CMP_DXT1:
-		size = BALIGN(file->width, 3U) * BALIGN(file->height, 3U);
-		break;
-	case GR_TEXFMT_ARGB_CMP_DXT3:
-	case GR_TEXFMT_ARGB_CMP_DXT5:
-		size = BALIGN(file->width, 3U) * BALIGN(file->height, 3U) * 2;
-		break;
-	default:
-		size = 0;
+	fmt = texture_format_get(file->format & ~GR_TEXFMT_GZ);
+	if (!fmt) {
 		fprintf(stderr, "Unsupported format %#"PRIx16"\n", file->format);
-		break;
+		return 0;
 	}
 
+	/* block formats store each started block completely */
+	size = DIV_ROUND_UP(file->width, fmt->block_width);
+	size *= DIV_ROUND_UP(file->height, fmt->block_height);
+	size *= fmt->block_width * fmt->block_height * fmt->bits_per_pixel / 8;
+
 	return size;
-#undef BALIGN
+#undef DIV_ROUND_UP
 }
 
 static int resize_image_dds(struct glide64_file *file)
 {
+	const struct texture_format *fmt;
 	DDS_HEADER *header;
 	size_t header_size = 128;
+	size_t data_size;
 	void *buf;
 
-	buf = malloc(file->size + header_size);
+	fmt = texture_format_get(file->format);
+	if (!fmt) {
+		fprintf(stderr, "Unsupported format %x\n", file->format);
+		return -EPERM;
+	}
+
+	if (!fmt->dds_pf_flags) {
+		fprintf(stderr, "Unsupported format GR_TEXFMT_%s\n", fmt->name);
+		return -EPERM;
+	}
+
+	/* payloads which are not in memory get copied from the input later */
+	data_size = file->size - file->payload_size;
+
+	buf = malloc(data_size + header_size);
 	if (!buf) {
 		fprintf(stderr, "Memory for DDS file couldn't be allocated\n");
 		return -ENOMEM;
@@ -173,129 +172,28 @@ static int resize_image_dds(struct glide64_file *file)
 	memset(header, 0, header_size);
 	header->dwMagic = htole32(0x20534444U);
 	header->dwSize = htole32(124);
-	header->dwFlags = htole32(DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT);
+	header->dwFlags = htole32(DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | fmt->dds_flags);
 	header->dwHeight = htole32(file->height);
 	header->dwWidth = htole32(file->width);
 	header->dwMipMapCount = htole32(1);
 	header->dwCaps = htole32(DDSCAPS_TEXTURE);
 
-	header->ddspf.dwSize = htole32(32);
-	switch (file->format) {
-	case GR_TEXFMT_ALPHA_8:
-		header->dwFlags |= DDSD_PITCH;
-		header->dwPitchOrLinearSize = htole32(file->width);
-		header->ddspf.dwFlags = htole32(DDPF_ALPHAPIXELS);
-		header->ddspf.dwRGBBitCount = htole32(8);
-		header->ddspf.dwABitMask = htole32(0xffU);
-		break;
-	case GR_TEXFMT_INTENSITY_8:
-		header->dwFlags |= DDSD_PITCH;
-		header->dwPitchOrLinearSize = htole32(file->width);
-		header->ddspf.dwFlags = htole32(DDPF_LUMINANCE);
-		header->ddspf.dwRGBBitCount = htole32(8);
-		header->ddspf.dwRBitMask = htole32(0xffU);
-		break;
-	case GR_TEXFMT_ALPHA_INTENSITY_44:
-		header->dwFlags |= DDSD_PITCH;
-		header->dwPitchOrLinearSize = htole32(file->width);
-		header->ddspf.dwFlags = htole32(DDPF_ALPHAPIXELS | DDPF_LUMINANCE);
-		header->ddspf.dwRGBBitCount = htole32(8);
-		header->ddspf.dwRBitMask = htole32(0x0fU);
-		header->ddspf.dwABitMask = htole32(0xf0U);
-		break;
-	case GR_TEXFMT_P_8:
-		fprintf(stderr, "Unsupported format GR_TEXFMT_P_8\n");
-		free(buf);
-		return -EPERM;
-	case GR_TEXFMT_RGB_565:
-		header->dwFlags |= DDSD_PITCH;
-		header->dwPitchOrLinearSize = htole32(file->width * 2);
-		header->ddspf.dwFlags = htole32(DDPF_RGB);
-		header->ddspf.dwRGBBitCount = htole32(16);
-		header->ddspf.dwRBitMask = htole32(0xf800U);
-		header->ddspf.dwGBitMask = htole32(0x07e0U);
-		header->ddspf.dwBBitMask = htole32(0x001fU);
-		break;
-	case GR_TEXFMT_ARGB_1555:
-		header->dwFlags |= DDSD_PITCH;
-		header->dwPitchOrLinearSize = htole32(file->width * 2);
-		header->ddspf.dwFlags = htole32(DDPF_ALPHAPIXELS | DDPF_RGB);
-		header->ddspf.dwRGBBitCount = htole32(16);
-		header->ddspf.dwRBitMask = htole32(0x7c00U);
-		header->ddspf.dwGBitMask = htole32(0x03e0U);
-		header->ddspf.dwBBitMask = htole32(0x001fU);
-		header->ddspf.dwABitMask = htole32(0x8000U);
-		break;
-	case GR_TEXFMT_ARGB_4444:
-		header->dwFlags |= DDSD_PITCH;
-		header->dwPitchOrLinearSize = htole32(file->width * 2);
-		header->ddspf.dwFlags = htole32(DDPF_ALPHAPIXELS | DDPF_RGB);
-		header->ddspf.dwRGBBitCount = htole32(16);
-		header->ddspf.dwRBitMask = htole32(0x7c00U);
-		header->ddspf.dwGBitMask = htole32(0x03e0U);
-		header->ddspf.dwBBitMask = htole32(0x001fU);
-		header->ddspf.dwABitMask = htole32(0x8000U);
-		break;
-	case GR_TEXFMT_ALPHA_INTENSITY_88:
-		header->dwFlags |= DDSD_PITCH;
-		header->dwPitchOrLinearSize = htole32(file->width * 2);
-		header->ddspf.dwFlags = htole32(DDPF_ALPHAPIXELS | DDPF_LUMINANCE);
-		header->ddspf.dwRGBBitCount = htole32(16);
-		header->ddspf.dwRBitMask = htole32(0x00ffU);
-		header->ddspf.dwABitMask = htole32(0xff00U);
-		break;
-	case GR_TEXFMT_ARGB_CMP_FXT1:
-		fprintf(stderr, "Unsupported format GR_TEXFMT_ARGB_CMP_FXT1\n");
-		free(buf);
-		return -EPERM;
-	case GR_TEXFMT_ARGB_8888:
-		header->dwFlags |= DDSD_PITCH;
-		header->dwPitchOrLinearSize = htole32(file->width * 4);
-		header->ddspf.dwFlags = htole32(DDPF_ALPHAPIXELS | DDPF_RGB);
-		header->ddspf.dwFourCC = htole32(0);
-		header->ddspf.dwRGBBitCount = htole32(32);
-		header->ddspf.dwRBitMask = htole32(0x00ff0000U);
-		header->ddspf.dwGBitMask = htole32(0x0000ff00U);
-		header->ddspf.dwBBitMask = htole32(0x000000ffU);
-		header->ddspf.dwABitMask = htole32(0xff000000U);
-		break;
-	case GR_TEXFMT_ARGB_CMP_DXT1:
-		header->dwFlags |= DDSD_LINEARSIZE;
-		header->dwPitchOrLinearSize = htole32(file->size);
-		header->ddspf.dwFlags = htole32(DDPF_FOURCC);
-		header->ddspf.dwFourCC = htole32(0x31545844U);
-		header->ddspf.dwRGBBitCount = htole32(24);
-		header->ddspf.dwRBitMask = htole32(0x00ff0000U);
-		header->ddspf.dwGBitMask = htole32(0x0000ff00U);
-		header->ddspf.dwBBitMask = htole32(0x000000ffU);
-		break;
-	case GR_TEXFMT_ARGB_CMP_DXT3:
-		header->dwFlags |= DDSD_LINEARSIZE;
+	if (fmt->dds_flags & DDSD_LINEARSIZE)
 		header->dwPitchOrLinearSize = htole32(file->size);
-		header->ddspf.dwFlags = htole32(DDPF_FOURCC);
-		header->ddspf.dwFourCC = htole32(0x33545844U);
-		header->ddspf.dwRGBBitCount = htole32(24);
-		header->ddspf.dwRBitMask = htole32(0x00ff0000U);
-		header->ddspf.dwGBitMask = htole32(0x0000ff00U);
-		header->ddspf.dwBBitMask = htole32(0x000000ffU);
-		break;
-	case GR_TEXFMT_ARGB_CMP_DXT5:
-		header->dwFlags |= DDSD_LINEARSIZE;
-		header->dwPitchOrLinearSize = htole32(file->size);
-		header->ddspf.dwFlags = htole32(DDPF_FOURCC);
-		header->ddspf.dwFourCC = htole32(0x35545844U);
-		header->ddspf.dwRGBBitCount = htole32(24);
-		header->ddspf.dwRBitMask = htole32(0x00ff0000U);
-		header->ddspf.dwGBitMask = htole32(0x0000ff00U);
-		header->ddspf.dwBBitMask = htole32(0x000000ffU);
-		break;
-	default:
-		fprintf(stderr, "Unsupported format %x\n", file->format);
-		free(buf);
-		return -EPERM;
-	}
+	else
+		header->dwPitchOrLinearSize = htole32(file->width * fmt->bits_per_pixel / 8);
 
-	memcpy((uint8_t *)buf + header_size, file->data, file->size);
+	header->ddspf.dwSize = htole32(32);
+	header->ddspf.dwFlags = htole32(fmt->dds_pf_flags);
+	header->ddspf.dwFourCC = htole32(fmt->dds_fourcc);
+	header->ddspf.dwRGBBitCount = htole32(fmt->dds_bitcount);
+	header->ddspf.dwRBitMask = htole32(fmt->dds_rmask);
+	header->ddspf.dwGBitMask = htole32(fmt->dds_gmask);
+	header->ddspf.dwBBitMask = htole32(fmt->dds_bmask);
+	header->ddspf.dwABitMask = htole32(fmt->dds_amask);
+
+	if (data_size)
+		memcpy((uint8_t *)buf + header_size, file->data, data_size);
 	free(file->data);
 	file->data = buf;
 	file->size += header_size;
@@ -303,6 +201,116 @@ static int resize_image_dds(struct glide64_file *file)
 	return 0;
 }
 
+static size_t bmp_line_size(uint32_t width, uint16_t bitcount)
+{
+	/* each line is padded to 4 bytes */
+	return ((size_t)width * (bitcount / 8) + 3) & ~(size_t)3;
+}
+
+/* opaque textures are stored with 24 bit or, when there are at most 256
+ * colors, with a palette - whichever of them is the smallest file. Returns
+ * 0 when the 32 bit bitmap is not larger.
+ */
+static int resize_image_bmp_reduced(struct glide64_file *file)
+{
+	struct color_palette palette;
+	struct bmp_header *header;
+	size_t pixels = (size_t)file->width * file->height;
+	uint32_t header_size = (uint32_t)sizeof(*header);
+	uint32_t height = file->height;
+	uint32_t palette_size = 0;
+	size_t line_size, data_size;
+	size_t full_size, size_8;
+	uint16_t bitcount = 24;
+	const uint8_t *source_pos;
+	uint8_t *buf, *target_pos;
+	uint32_t color;
+	uint32_t i, x;
+
+	if (file->payload_size || !image_opaque(file->data, pixels))
+		return 0;
+
+	if (globals.bitmapv5)
+		full_size = sizeof(struct bmp_header_v5) + pixels * 4;
+	else
+		full_size = sizeof(struct bmp_header) + pixels * 4;
+
+	line_size = bmp_line_size(file->width, 24);
+	data_size = line_size * file->height;
+
+	/* the palette doesn't pay off for small textures */
+	if (image_palette(file->data, pixels, &palette) == 0) {
+		size_8 = palette.count * 4 + bmp_line_size(file->width, 8) * file->height;
+		if (size_8 < data_size) {
+			bitcount = 8;
+			palette_size = palette.count * 4;
+			line_size = bmp_line_size(file->width, 8);
+			data_size = line_size * file->height;
+		}
+	}
+
+	if (header_size + palette_size + data_size >= full_size)
+		return 0;
+
+	if (data_size > UINT32_MAX - header_size - palette_size)
+		return 0;
+
+	buf = calloc(1, header_size + palette_size + data_size);
+	if (!buf) {
+		fprintf(stderr, "Memory for BMP file couldn't be allocated\n");
+		return -ENOMEM;
+	}
+
+	if (globals.top_down)
+		height = (uint32_t)-(int32_t)file->height;
+
+	header = (struct bmp_header *)buf;
+	header->identifier = htole16(0x4d42U);
+	header->filesize = htole32(header_size + palette_size + data_size);
+	header->dataofs = htole32(header_size + palette_size);
+	header->headersize = htole32(header_size - 14);
+	header->width = htole32(file->width);
+	header->height = htole32(height);
+	header->planes = htole16(1);
+	header->bitperpixel = htole16(bitcount);
+	header->compression = htole32(0);
+	header->datasize = htole32(data_size);
+	header->hresolution = htole32(2835);
+	header->vresolution = htole32(2835);
+	header->colors = htole32(bitcount == 8 ? palette.count : 0);
+	header->importantcolors = htole32(0);
+
+	/* palette entries have the same byte order as the pixels */
+	target_pos = buf + header_size;
+	for (i = 0; bitcount == 8 && i < palette.count; i++) {
+		memcpy(target_pos, &palette.colors[i], 4);
+		target_pos[3] = 0;
+		target_pos += 4;
+	}
+
+	for (i = 0; i < file->height; i++) {
+		uint32_t source_line = globals.top_down ? i : file->height - i - 1;
+
+		source_pos = (const uint8_t *)file->data + (size_t)source_line * file->width * 4;
+		target_pos = buf + header_size + palette_size + (size_t)i * line_size;
+
+		for (x = 0; x < file->width; x++) {
+			if (bitcount == 8) {
+				memcpy(&color, &source_pos[x * 4], sizeof(color));
+				target_pos[x] = palette_index(&palette, color);
+			} else {
+				memcpy(&target_pos[x * 3], &source_pos[x * 4], 3);
+			}
+		}
+	}
+
+	free(file->data);
+	file->data = buf;
+	file->size = header_size + palette_size + (uint32_t)data_size;
+
+	return 1;
+}
+
 static int resize_image_bmp(struct glide64_file *file)
 {
 	struct bmp_header *header;
@@ -311,13 +319,22 @@ static int resize_image_bmp(struct glide64_file *file)
 	void *buf;
 	uint8_t *imagedata;
 	size_t line_size = file->width * 4;
+	uint32_t height = file->height;
+	size_t data_size;
 	uint32_t i;
+	int ret;
 
 	if (file->format != GR_TEXFMT_ARGB_8888) {
 		fprintf(stderr, "Unsupported texture format %#x for bmp export\n", file->format);
 		return -EPERM;
 	}
 
+	if (globals.reduce) {
+		ret = resize_image_bmp_reduced(file);
+		if (ret != 0)
+			return ret < 0 ? ret : 0;
+	}
+
 	if (globals.bitmapv5)
 		header_size = (uint32_t)sizeof(*header_v5);
 	else
@@ -328,7 +345,14 @@ static int resize_image_bmp(struct glide64_file *file)
 		return -EPERM;
 	}
 
-	buf = malloc(file->size + header_size);
+	/* negative height marks rows which are stored top-down */
+	if (globals.top_down)
+		height = (uint32_t)-(int32_t)file->height;
+
+	/* payloads which are not in memory get copied from the input later */
+	data_size = file->size - file->payload_size;
+
+	buf = malloc(data_size + header_size);
 	if (!buf) {
 		fprintf(stderr, "Memory for BMP file couldn't be allocated\n");
 		return -ENOMEM;
@@ -342,7 +366,7 @@ static int resize_image_bmp(struct glide64_file *file)
 		header_v5->dataofs = htole32(header_size);
 		header_v5->headersize = htole32(header_size - 14);
 		header_v5->width = htole32(file->width);
-		header_v5->height = htole32(file->height);
+		header_v5->height = htole32(height);
 		header_v5->planes = htole16(1);
 		header_v5->bitperpixel = htole16(32);
 		header_v5->compression = htole32(3);
@@ -378,7 +402,7 @@ static int resize_image_bmp(struct glide64_file *file)
 		header->dataofs = htole32(header_size);
 		header->headersize = htole32(header_size - 14);
 		header->width = htole32(file->width);
-		header->height = htole32(file->height);
+		header->height = htole32(height);
 		header->planes = htole16(1);
 		header->bitperpixel = htole16(32);
 		header->compression = htole32(0);
@@ -390,6 +414,11 @@ static int resize_image_bmp(struct glide64_file *file)
 	}
 
 	imagedata = (uint8_t *)buf + header_size;
+	if (globals.top_down) {
+		memcpy(imagedata, file->data, data_size);
+		goto out;
+	}
+
 	for (i = 0; i < file->height; i++) {
 		uint32_t target_line = i;
 		uint32_t source_line = file->height - i - 1;
@@ -400,6 +429,8 @@ static int resize_image_bmp(struct glide64_file *file)
 
 		memcpy(target_pos, source_pos, line_size);
 	}
+
+out:
 	free(file->data);
 	file->data = buf;
 	file->size += header_size;
@@ -407,209 +438,319 @@ static int resize_image_bmp(struct glide64_file *file)
 	return 0;
 }
 
-static int normalize_image_a8(struct glide64_file *file)
+#define load8(raw) (raw)
+#define load16(raw) le16toh(raw)
+
+static inline uint32_t expand_a8(uint32_t raw)
 {
-	uint32_t *buf;
-	uint8_t *data, raw;
-	size_t newsize;
-	size_t pixels, pos;
-	uint32_t p, a;
+	return (raw << 24) | (raw << 16) | (raw << 8) | raw;
+}
 
-	pixels = file->width * file->height;
-	newsize = pixels * 4;
-	if (newsize > UINT32_MAX)
-		return -EINVAL;
+static inline uint32_t expand_i8(uint32_t raw)
+{
+	return (raw << 24) | (raw << 16) | (raw << 8) | raw;
+}
 
-	buf = malloc(newsize);
-	if (!buf) {
-		fprintf(stderr, "Memory for A8 image content couldn't be allocated\n");
-		return -ENOMEM;
-	}
+static inline uint32_t expand_a4i4(uint32_t raw)
+{
+	uint32_t a, i;
 
-	data = file->data;
-	for (pos = 0; pos < pixels; pos++) {
-		raw = data[pos];
-		a = raw;
-		p = (a << 24) | (a << 16) | (a << 8) | a;
-		buf[pos] = htole32(p);
-	}
+	i = (raw & 0x0fU) << 4;
+	i |= i >> 4;
+	a = (raw & 0xf0U);
+	a |= a >> 4;
 
-	free(file->data);
-	file->data = (uint8_t *)buf;
-	file->size = (uint32_t)newsize;
-	file->format = GR_TEXFMT_ARGB_8888;
+	return (a << 24) | (i << 16) | (i << 8) | i;
+}
 
-	return 0;
+static inline uint32_t expand_r5g6b5(uint32_t raw)
+{
+	uint32_t r, g, b;
+
+	r = (raw & 0xf800U) >> 8;
+	r |= r >> 5;
+	g = (raw & 0x07e0U) >> 3;
+	g |= g >> 6;
+	b = (raw & 0x001fU) << 3;
+	b |= b >> 5;
+
+	return (0xffU << 24) | (r << 16) | (g << 8) | b;
 }
 
-static int normalize_image_i8(struct glide64_file *file)
+static inline uint32_t expand_a1r5g5b5(uint32_t raw)
 {
-	uint32_t *buf;
-	uint8_t *data, raw;
-	size_t newsize;
-	size_t pixels, pos;
-	uint32_t p, i;
+	uint32_t a, r, g, b;
+
+	a = (raw & 0x8000U) >> 15;
+	a *= 0xffU;
+	r = (raw & 0x7c00U) >> 7;
+	r |= r >> 5;
+	g = (raw & 0x03e0U) >> 2;
+	g |= g >> 5;
+	b = (raw & 0x001fU) << 3;
+	b |= b >> 5;
+
+	return (a << 24) | (r << 16) | (g << 8) | b;
+}
 
-	pixels = file->width * file->height;
-	newsize = pixels * 4;
-	if (newsize > UINT32_MAX)
-		return -EINVAL;
+static inline uint32_t expand_a4r4g4b4(uint32_t raw)
+{
+	uint32_t a, r, g, b;
+
+	a = (raw & 0xf000U) >> 4;
+	a |= a >> 4;
+	r = (raw & 0x0f00U) >> 4;
+	r |= r >> 4;
+	g = (raw & 0x00f0U);
+	g |= g >> 4;
+	b = (raw & 0x000fU) << 4;
+	b |= b >> 4;
+
+	return (a << 24) | (r << 16) | (g << 8) | b;
+}
 
-	buf = malloc(newsize);
-	if (!buf) {
-		fprintf(stderr, "Memory for I8 image content couldn't be allocated\n");
-		return -ENOMEM;
-	}
+static inline uint32_t expand_a8i8(uint32_t raw)
+{
+	uint32_t a, i;
 
-	data = file->data;
-	for (pos = 0; pos < pixels; pos++) {
-		raw = data[pos];
-		i = raw;
-		p = (i << 24) | (i << 16) | (i << 8) | i;
-		buf[pos] = htole32(p);
-	}
+	a = (raw & 0xff00U) >> 8;
+	i = (raw & 0x00ffU);
 
-	free(file->data);
-	file->data = (uint8_t *)buf;
-	file->size = (uint32_t)newsize;
-	file->format = GR_TEXFMT_ARGB_8888;
+	return (a << 24) | (i << 16) | (i << 8) | i;
+}
 
-	return 0;
+#define EXPAND_IMAGE(_name, _type, _load) \
+static void expand_image_##_name(uint32_t *dst, const void *src, size_t pixels) \
+{ \
+	const _type *data = src; \
+	size_t pos; \
+ \
+	for (pos = 0; pos < pixels; pos++) \
+		dst[pos] = htole32(expand_##_name(_load(data[pos]))); \
 }
 
-static int normalize_image_a4i4(struct glide64_file *file)
+EXPAND_IMAGE(a8, uint8_t, load8)
+EXPAND_IMAGE(i8, uint8_t, load8)
+EXPAND_IMAGE(a4i4, uint8_t, load8)
+EXPAND_IMAGE(r5g6b5, uint16_t, load16)
+EXPAND_IMAGE(a1r5g5b5, uint16_t, load16)
+EXPAND_IMAGE(a4r4g4b4, uint16_t, load16)
+EXPAND_IMAGE(a8i8, uint16_t, load16)
+
+/* inverse conversions for the cache builder. The lower bits of each channel
+ * are dropped, which restores the stored value of an expanded pixel.
+ */
+#define store8(raw) ((uint8_t)(raw))
+#define store16(raw) htole16((uint16_t)(raw))
+
+static inline uint32_t pixel_intensity(uint32_t pixel)
 {
-	uint32_t *buf;
-	uint8_t *data, raw;
-	size_t newsize;
-	size_t pixels, pos;
-	uint32_t p, a, i;
+	uint32_t r = (pixel >> 16) & 0xffU;
+	uint32_t g = (pixel >> 8) & 0xffU;
+	uint32_t b = pixel & 0xffU;
 
-	pixels = file->width * file->height;
-	newsize = pixels * 4;
-	if (newsize > UINT32_MAX)
-		return -EINVAL;
+	return (r * 77U + g * 150U + b * 29U) >> 8;
+}
 
-	buf = malloc(newsize);
-	if (!buf) {
-		fprintf(stderr, "Memory for A4I4 image content couldn't be allocated\n");
-		return -ENOMEM;
-	}
+static inline uint32_t pack_a8(uint32_t pixel)
+{
+	return pixel >> 24;
+}
 
-	data = file->data;
-	for (pos = 0; pos < pixels; pos++) {
-		raw = data[pos];
-		i = (raw & 0x0fU) << 4;
-		i |= i >> 4;
-		a = (raw & 0xf0U);
-		a |= a >> 4;
-		p = (a << 24) | (i << 16) | (i << 8) | i;
-		buf[pos] = htole32(p);
-	}
+static inline uint32_t pack_i8(uint32_t pixel)
+{
+	return pixel_intensity(pixel);
+}
 
-	free(file->data);
-	file->data = (uint8_t *)buf;
-	file->size = (uint32_t)newsize;
-	file->format = GR_TEXFMT_ARGB_8888;
+static inline uint32_t pack_a4i4(uint32_t pixel)
+{
+	return ((pixel >> 24) & 0xf0U) | (pixel_intensity(pixel) >> 4);
+}
 
-	return 0;
+static inline uint32_t pack_r5g6b5(uint32_t pixel)
+{
+	return ((pixel >> 8) & 0xf800U) | ((pixel >> 5) & 0x07e0U) |
+	       ((pixel >> 3) & 0x001fU);
 }
 
-static int normalize_image_p8(struct glide64_file *file __attribute__((unused)))
+static inline uint32_t pack_a1r5g5b5(uint32_t pixel)
 {
-	fprintf(stderr, "Unsupported format GR_TEXFMT_P_8\n");
-	return -EPERM;
+	return ((pixel >> 16) & 0x8000U) | ((pixel >> 9) & 0x7c00U) |
+	       ((pixel >> 6) & 0x03e0U) | ((pixel >> 3) & 0x001fU);
 }
 
-static int normalize_image_r5g6b5(struct glide64_file *file)
+static inline uint32_t pack_a4r4g4b4(uint32_t pixel)
 {
-	uint32_t *buf;
-	uint16_t *data, raw;
-	size_t newsize;
-	size_t pixels, pos;
-	uint32_t p, r, g, b;
+	return ((pixel >> 16) & 0xf000U) | ((pixel >> 12) & 0x0f00U) |
+	       ((pixel >> 8) & 0x00f0U) | ((pixel >> 4) & 0x000fU);
+}
 
-	pixels = file->width * file->height;
-	newsize = pixels * 4;
-	if (newsize > UINT32_MAX)
-		return -EINVAL;
+static inline uint32_t pack_a8i8(uint32_t pixel)
+{
+	return ((pixel >> 16) & 0xff00U) | pixel_intensity(pixel);
+}
 
-	buf = malloc(newsize);
-	if (!buf) {
-		fprintf(stderr, "Memory for R5G6B5 image content couldn't be allocated\n");
+#define PACK_IMAGE(_name, _type, _store) \
+static void pack_image_##_name(void *dst, const uint32_t *src, size_t pixels) \
+{ \
+	_type *data = dst; \
+	size_t pos; \
+ \
+	for (pos = 0; pos < pixels; pos++) \
+		data[pos] = _store(pack_##_name(le32toh(src[pos]))); \
+}
+
+PACK_IMAGE(a8, uint8_t, store8)
+PACK_IMAGE(i8, uint8_t, store8)
+PACK_IMAGE(a4i4, uint8_t, store8)
+PACK_IMAGE(r5g6b5, uint16_t, store16)
+PACK_IMAGE(a1r5g5b5, uint16_t, store16)
+PACK_IMAGE(a4r4g4b4, uint16_t, store16)
+PACK_IMAGE(a8i8, uint16_t, store16)
+
+enum lut_state {
+	LUT_STATE_UNKNOWN = 0,
+	LUT_STATE_TABLE,
+	LUT_STATE_BITS,
+};
+
+struct expand_lut {
+	enum lut_state state;
+	uint32_t *table;
+};
+
+static struct expand_lut lut_r5g6b5;
+static struct expand_lut lut_a1r5g5b5;
+static struct expand_lut lut_a4r4g4b4;
+static struct expand_lut lut_a8i8;
+static pthread_mutex_t lut_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define LUT_ENTRIES		65536U
+#define LUT_BENCH_ROUNDS	8
+
+static void expand_image_lut(uint32_t *dst, const void *src, size_t pixels,
+			     const uint32_t *table)
+{
+	const uint16_t *data = src;
+	size_t pos;
+
+	for (pos = 0; pos < pixels; pos++)
+		dst[pos] = table[load16(data[pos])];
+}
+
+static uint64_t time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* compare both kernels on a shuffled 64K pixel image and keep the faster */
+static int lut_benchmark(const struct texture_format *fmt)
+{
+	struct expand_lut *lut = fmt->lut;
+	uint64_t best_bits = UINT64_MAX;
+	uint64_t best_table = UINT64_MAX;
+	uint64_t start, duration;
+	uint16_t *src;
+	uint32_t *dst;
+	uint32_t seed = 0x12345678U;
+	size_t i;
+
+	src = malloc(LUT_ENTRIES * sizeof(*src));
+	dst = malloc(LUT_ENTRIES * sizeof(*dst));
+	if (!src || !dst) {
+		free(src);
+		free(dst);
 		return -ENOMEM;
 	}
 
-	data = (uint16_t *)file->data;
-	for (pos = 0; pos < pixels; pos++) {
-		raw = le16toh(data[pos]);
-		r = (raw & 0xf800U) >> 8;
-		r |= r >> 5;
-		g = (raw & 0x07e0U) >> 3;
-		g |= g >> 6;
-		b = (raw & 0x001fU) << 3;
-		b |= b >> 5;
-		p = (0xffU << 24) | (r << 16) | (g << 8) | b;
-		buf[pos] = htole32(p);
+	for (i = 0; i < LUT_ENTRIES; i++) {
+		seed = seed * 1103515245U + 12345U;
+		src[i] = htole16((uint16_t)(seed >> 16));
 	}
 
-	free(file->data);
-	file->data = (uint8_t *)buf;
-	file->size = (uint32_t)newsize;
-	file->format = GR_TEXFMT_ARGB_8888;
+	for (i = 0; i < LUT_BENCH_ROUNDS; i++) {
+		start = time_ns();
+		fmt->expand(dst, src, LUT_ENTRIES);
+		duration = time_ns() - start;
+		if (duration < best_bits)
+			best_bits = duration;
+
+		start = time_ns();
+		expand_image_lut(dst, src, LUT_ENTRIES, lut->table);
+		duration = time_ns() - start;
+		if (duration < best_table)
+			best_table = duration;
+	}
+
+	free(src);
+	free(dst);
+
+	if (best_table < best_bits)
+		lut->state = LUT_STATE_TABLE;
+	else
+		lut->state = LUT_STATE_BITS;
+
+	if (globals.verbose >= VERBOSITY_GLOBAL_HEADER)
+		fprintf(stderr, "Conversion of %s: table %"PRIu64" ns, bit math %"PRIu64" ns per 64K pixels, using %s\n",
+			fmt->name, best_table, best_bits,
+			lut->state == LUT_STATE_TABLE ? "table" : "bit math");
 
 	return 0;
 }
 
-static int normalize_image_a1r5g5b5(struct glide64_file *file)
+static int lut_prepare(const struct texture_format *fmt)
 {
-	uint32_t *buf;
-	uint16_t *data, raw;
-	size_t newsize;
-	size_t pixels, pos;
-	uint32_t p, a, r, g, b;
+	struct expand_lut *lut = fmt->lut;
+	uint16_t *src;
+	size_t i;
+	int ret;
 
-	pixels = file->width * file->height;
-	newsize = pixels * 4;
-	if (newsize > UINT32_MAX)
-		return -EINVAL;
+	if (globals.lut == LUT_NEVER) {
+		lut->state = LUT_STATE_BITS;
+		return 0;
+	}
 
-	buf = malloc(newsize);
-	if (!buf) {
-		fprintf(stderr, "Memory for A1R5G5B5 image content couldn't be allocated\n");
-		return -ENOMEM;
+	src = malloc(LUT_ENTRIES * sizeof(*src));
+	lut->table = malloc(LUT_ENTRIES * sizeof(*lut->table));
+	if (!src || !lut->table) {
+		free(src);
+		free(lut->table);
+		lut->table = NULL;
+		lut->state = LUT_STATE_BITS;
+		return 0;
 	}
 
-	data = (uint16_t *)file->data;
-	for (pos = 0; pos < pixels; pos++) {
-		raw = le16toh(data[pos]);
-		a = (raw & 0x8000U) >> 15;
-		a *= 0xffU;
-		r = (raw & 0x7c00U) >> 7;
-		r |= r >> 5;
-		g = (raw & 0x03e0U) >> 2;
-		g |= g >> 5;
-		b = (raw & 0x001fU) << 3;
-		b |= b >> 5;
-		p = (a << 24) | (r << 16) | (g << 8) | b;
-		buf[pos] = htole32(p);
+	for (i = 0; i < LUT_ENTRIES; i++)
+		src[i] = htole16((uint16_t)i);
+
+	fmt->expand(lut->table, src, LUT_ENTRIES);
+	free(src);
+
+	if (globals.lut == LUT_ALWAYS) {
+		lut->state = LUT_STATE_TABLE;
+		return 0;
 	}
 
-	free(file->data);
-	file->data = (uint8_t *)buf;
-	file->size = (uint32_t)newsize;
-	file->format = GR_TEXFMT_ARGB_8888;
+	ret = lut_benchmark(fmt);
+	if (ret < 0 || lut->state != LUT_STATE_TABLE) {
+		free(lut->table);
+		lut->table = NULL;
+		lut->state = LUT_STATE_BITS;
+	}
 
 	return 0;
 }
 
-static int normalize_image_a4r4g4b4(struct glide64_file *file)
+static int normalize_image(struct glide64_file *file,
+			   const struct texture_format *fmt)
 {
+	enum lut_state state;
 	uint32_t *buf;
-	uint16_t *data, raw;
 	size_t newsize;
-	size_t pixels, pos;
-	uint32_t p, a, r, g, b;
+	size_t pixels;
 
 	pixels = file->width * file->height;
 	newsize = pixels * 4;
@@ -618,25 +759,24 @@ static int normalize_image_a4r4g4b4(struct glide64_file *file)
 
 	buf = malloc(newsize);
 	if (!buf) {
-		fprintf(stderr, "Memory for A4R4G4B4 image content couldn't be allocated\n");
+		fprintf(stderr, "Memory for %s image content couldn't be allocated\n", fmt->name);
 		return -ENOMEM;
 	}
 
-	data = (uint16_t *)file->data;
-	for (pos = 0; pos < pixels; pos++) {
-		raw = le16toh(data[pos]);
-		a = (raw & 0xf000U) >> 4;
-		a |= a >> 4;
-		r = (raw & 0x0f00U) >> 4;
-		r |= r >> 4;
-		g = (raw & 0x00f0U);
-		g |= g >> 4;
-		b = (raw & 0x000fU) << 4;
-		b |= b >> 4;
-		p = (a << 24) | (r << 16) | (g << 8) | b;
-		buf[pos] = htole32(p);
+	state = LUT_STATE_BITS;
+	if (fmt->lut) {
+		pthread_mutex_lock(&lut_lock);
+		if (fmt->lut->state == LUT_STATE_UNKNOWN)
+			lut_prepare(fmt);
+		state = fmt->lut->state;
+		pthread_mutex_unlock(&lut_lock);
 	}
 
+	if (state == LUT_STATE_TABLE)
+		expand_image_lut(buf, file->data, pixels, fmt->lut->table);
+	else
+		fmt->expand(buf, file->data, pixels);
+
 	free(file->data);
 	file->data = (uint8_t *)buf;
 	file->size = (uint32_t)newsize;
@@ -645,131 +785,378 @@ static int normalize_image_a4r4g4b4(struct glide64_file *file)
 	return 0;
 }
 
-static int normalize_image_a8i8(struct glide64_file *file)
+#define TEXFMT_PLAIN(_name, _bpp, _expand, _pack) \
+	.name = _name, \
+	.bits_per_pixel = _bpp, \
+	.block_width = 1, \
+	.block_height = 1, \
+	.container = CONTAINER_BMP, \
+	.expand = _expand, \
+	.pack = _pack, \
+	.dds_flags = DDSD_PITCH, \
+	.dds_bitcount = _bpp
+
+#define TEXFMT_BLOCK(_name, _bpp, _bw, _bh, _fourcc) \
+	.name = _name, \
+	.bits_per_pixel = _bpp, \
+	.block_width = _bw, \
+	.block_height = _bh, \
+	.container = CONTAINER_DDS, \
+	.dds_flags = DDSD_LINEARSIZE, \
+	.dds_pf_flags = DDPF_FOURCC, \
+	.dds_fourcc = _fourcc, \
+	.dds_bitcount = 24, \
+	.dds_rmask = 0x00ff0000U, \
+	.dds_gmask = 0x0000ff00U, \
+	.dds_bmask = 0x000000ffU
+
+static const struct texture_format texture_formats[] = {
+	[GR_TEXFMT_ALPHA_8] = {
+		TEXFMT_PLAIN("ALPHA_8", 8, expand_image_a8, pack_image_a8),
+		.dds_pf_flags = DDPF_ALPHA,
+		.dds_amask = 0xffU,
+	},
+	[GR_TEXFMT_INTENSITY_8] = {
+		TEXFMT_PLAIN("INTENSITY_8", 8, expand_image_i8, pack_image_i8),
+		.dds_pf_flags = DDPF_LUMINANCE,
+		.dds_rmask = 0xffU,
+	},
+	[GR_TEXFMT_ALPHA_INTENSITY_44] = {
+		TEXFMT_PLAIN("ALPHA_INTENSITY_44", 8, expand_image_a4i4, pack_image_a4i4),
+		.dds_pf_flags = DDPF_ALPHAPIXELS | DDPF_LUMINANCE,
+		.dds_rmask = 0x0fU,
+		.dds_amask = 0xf0U,
+	},
+	[GR_TEXFMT_P_8] = {
+		.name = "P_8",
+		.bits_per_pixel = 8,
+		.block_width = 1,
+		.block_height = 1,
+		.container = CONTAINER_NONE,
+	},
+	[GR_TEXFMT_RGB_565] = {
+		TEXFMT_PLAIN("RGB_565", 16, expand_image_r5g6b5, pack_image_r5g6b5),
+		.lut = &lut_r5g6b5,
+		.dds_pf_flags = DDPF_RGB,
+		.dds_rmask = 0xf800U,
+		.dds_gmask = 0x07e0U,
+		.dds_bmask = 0x001fU,
+	},
+	[GR_TEXFMT_ARGB_1555] = {
+		TEXFMT_PLAIN("ARGB_1555", 16, expand_image_a1r5g5b5, pack_image_a1r5g5b5),
+		.lut = &lut_a1r5g5b5,
+		.dds_pf_flags = DDPF_ALPHAPIXELS | DDPF_RGB,
+		.dds_rmask = 0x7c00U,
+		.dds_gmask = 0x03e0U,
+		.dds_bmask = 0x001fU,
+		.dds_amask = 0x8000U,
+	},
+	[GR_TEXFMT_ARGB_4444] = {
+		TEXFMT_PLAIN("ARGB_4444", 16, expand_image_a4r4g4b4, pack_image_a4r4g4b4),
+		.lut = &lut_a4r4g4b4,
+		.dds_pf_flags = DDPF_ALPHAPIXELS | DDPF_RGB,
+		.dds_rmask = 0x0f00U,
+		.dds_gmask = 0x00f0U,
+		.dds_bmask = 0x000fU,
+		.dds_amask = 0xf000U,
+	},
+	[GR_TEXFMT_ALPHA_INTENSITY_88] = {
+		TEXFMT_PLAIN("ALPHA_INTENSITY_88", 16, expand_image_a8i8, pack_image_a8i8),
+		.lut = &lut_a8i8,
+		.dds_pf_flags = DDPF_ALPHAPIXELS | DDPF_LUMINANCE,
+		.dds_rmask = 0x00ffU,
+		.dds_amask = 0xff00U,
+	},
+	[GR_TEXFMT_ARGB_CMP_FXT1] = {
+		.name = "ARGB_CMP_FXT1",
+		.bits_per_pixel = 4,
+		.block_width = 8,
+		.block_height = 4,
+		.container = CONTAINER_NONE,
+	},
+	[GR_TEXFMT_ARGB_8888] = {
+		TEXFMT_PLAIN("ARGB_8888", 32, NULL, NULL),
+		.dds_pf_flags = DDPF_ALPHAPIXELS | DDPF_RGB,
+		.dds_rmask = 0x00ff0000U,
+		.dds_gmask = 0x0000ff00U,
+		.dds_bmask = 0x000000ffU,
+		.dds_amask = 0xff000000U,
+	},
+	[GR_TEXFMT_ARGB_CMP_DXT1] = {
+		TEXFMT_BLOCK("ARGB_CMP_DXT1", 4, 4, 4, 0x31545844U),
+	},
+	[GR_TEXFMT_ARGB_CMP_DXT3] = {
+		TEXFMT_BLOCK("ARGB_CMP_DXT3", 8, 4, 4, 0x33545844U),
+	},
+	[GR_TEXFMT_ARGB_CMP_DXT5] = {
+		TEXFMT_BLOCK("ARGB_CMP_DXT5", 8, 4, 4, 0x35545844U),
+	},
+};
+
+const struct texture_format *texture_format_get(uint16_t format)
 {
-	uint32_t *buf;
-	uint16_t *data, raw;
-	size_t newsize;
-	size_t pixels, pos;
-	uint32_t p, a, i;
+	const struct texture_format *fmt;
 
-	pixels = file->width * file->height;
-	newsize = pixels * 4;
+	if (format >= sizeof(texture_formats) / sizeof(texture_formats[0]))
+		return NULL;
+
+	fmt = &texture_formats[format];
+	if (!fmt->bits_per_pixel)
+		return NULL;
+
+	return fmt;
+}
+
+static int encode_applies(const struct texture_format *fmt)
+{
+	if (globals.encode == ENCODE_NONE || fmt->container != CONTAINER_BMP)
+		return 0;
+
+	return !(globals.native && fmt->dds_pf_flags);
+}
+
+enum texture_container texture_container_get(const struct texture_format *fmt)
+{
+	/* DDS can describe all uncompressed formats in their stored layout */
+	if (globals.native && fmt->dds_pf_flags)
+		return CONTAINER_DDS;
+
+	if (encode_applies(fmt))
+		return CONTAINER_DDS;
+
+	return fmt->container;
+}
+
+/* Glide64 splits textures wider than the maximum texture width into
+ * tiles of the stored width and stacks them vertically
+ */
+static int untile_applies(const struct glide64_file *file)
+{
+	if (!globals.untile || file->tiles <= 1)
+		return 0;
+
+	if (!file->untiled_width || !file->untiled_height)
+		return 0;
+
+	if ((uint64_t)file->width * file->tiles < file->untiled_width)
+		return 0;
+
+	if ((uint64_t)file->untiled_height * file->tiles > file->height)
+		return 0;
+
+	return 1;
+}
+
+static int untile_image(struct glide64_file *file)
+{
+	const uint8_t *src = file->data;
+	size_t tile_line = (size_t)file->width * 4;
+	size_t line_size = (size_t)file->untiled_width * 4;
+	size_t tile_size = tile_line * file->untiled_height;
+	size_t newsize, len;
+	uint8_t *buf, *dst;
+	uint32_t x, y, t;
+
+	newsize = line_size * file->untiled_height;
 	if (newsize > UINT32_MAX)
 		return -EINVAL;
 
 	buf = malloc(newsize);
 	if (!buf) {
-		fprintf(stderr, "Memory for A4R4G4B4 image content couldn't be allocated\n");
+		fprintf(stderr, "Memory for untiled image couldn't be allocated\n");
 		return -ENOMEM;
 	}
 
-	data = (uint16_t *)file->data;
-	for (pos = 0; pos < pixels; pos++) {
-		raw = le16toh(data[pos]);
-		a = (raw & 0xff00U) >> 8;
-		i = (raw & 0x00ffU);
-		p = (a << 24) | (i << 16) | (i << 8) | i;
-		buf[pos] = htole32(p);
+	/* write each target line sequentially from the matching tile lines */
+	dst = buf;
+	for (y = 0; y < file->untiled_height; y++) {
+		for (t = 0, x = 0; x < file->untiled_width; t++, x += file->width) {
+			len = tile_line;
+			if (len > line_size - (size_t)x * 4)
+				len = line_size - (size_t)x * 4;
+
+			memcpy(dst, src + t * tile_size + y * tile_line, len);
+			dst += len;
+		}
 	}
 
 	free(file->data);
-	file->data = (uint8_t *)buf;
+	file->data = buf;
+	file->width = file->untiled_width;
+	file->height = file->untiled_height;
 	file->size = (uint32_t)newsize;
-	file->format = GR_TEXFMT_ARGB_8888;
 
 	return 0;
 }
 
-static int resize_image_content(struct glide64_file *file)
+static int expand_image_content(struct glide64_file *file,
+				const struct texture_format *fmt)
 {
+	uint64_t start = trace_begin();
 	int ret;
 
-	switch (file->format) {
-	case GR_TEXFMT_ALPHA_8:
-		ret = normalize_image_a8(file);
+	if (fmt->expand) {
+		ret = normalize_image(file, fmt);
 		if (ret < 0) {
-			fprintf(stderr, "Error during conversion from ALPHA_8 to ARGB_8888\n");
+			fprintf(stderr, "Error during conversion from %s to ARGB_8888\n", fmt->name);
 			return ret;
 		}
+	}
 
-		return resize_image_bmp(file);
-	case GR_TEXFMT_INTENSITY_8:
-		ret = normalize_image_i8(file);
+	if (untile_applies(file)) {
+		ret = untile_image(file);
 		if (ret < 0) {
-			fprintf(stderr, "Error during conversion from INTENSITY_8 to ARGB_8888\n");
+			fprintf(stderr, "Error during untiling of texture\n");
 			return ret;
 		}
+	}
 
-		return resize_image_bmp(file);
-	case GR_TEXFMT_ALPHA_INTENSITY_44:
-		ret = normalize_image_a4i4(file);
-		if (ret < 0) {
-			fprintf(stderr, "Error during conversion from INTENSITY_44 to ARGB_8888\n");
-			return ret;
-		}
+	trace_end(file, "normalize", start);
 
-		return resize_image_bmp(file);
-	case GR_TEXFMT_P_8:
-		ret = normalize_image_p8(file);
-		if (ret < 0) {
-			fprintf(stderr, "Error during conversion from P_8 to ARGB_8888\n");
-			return ret;
-		}
+	return 0;
+}
 
-		return resize_image_bmp(file);
-	case GR_TEXFMT_RGB_565:
-		ret = normalize_image_r5g6b5(file);
-		if (ret < 0) {
-			fprintf(stderr, "Error during conversion from RGB_565 to ARGB_8888\n");
-			return ret;
-		}
+static int resize_image_content(struct glide64_file *file)
+{
+	const struct texture_format *fmt;
+	uint64_t start;
+	int ret;
 
-		return resize_image_bmp(file);
-	case GR_TEXFMT_ARGB_1555:
-		ret = normalize_image_a1r5g5b5(file);
-		if (ret < 0) {
-			fprintf(stderr, "Error during conversion from ARGB_1555 to ARGB_8888\n");
-			return ret;
-		}
+	fmt = texture_format_get(file->format);
+	if (!fmt) {
+		fprintf(stderr, "Unsupported format %x\n", file->format);
+		return -EPERM;
+	}
 
-		return resize_image_bmp(file);
-	case GR_TEXFMT_ARGB_4444:
-		ret = normalize_image_a4r4g4b4(file);
-		if (ret < 0) {
-			fprintf(stderr, "Error during conversion from ARGB_4444 to ARGB_8888\n");
+	switch (texture_container_get(fmt)) {
+	case CONTAINER_BMP:
+		ret = expand_image_content(file, fmt);
+		if (ret < 0)
 			return ret;
-		}
 
-		return resize_image_bmp(file);
-	case GR_TEXFMT_ALPHA_INTENSITY_88:
-		ret = normalize_image_a8i8(file);
-		if (ret < 0) {
-			fprintf(stderr, "Error during conversion from ALPHA_INTENSITY_88 to ARGB_8888\n");
-			return ret;
+		start = trace_begin();
+		ret = resize_image_bmp(file);
+		trace_end(file, "wrap", start);
+
+		return ret;
+	case CONTAINER_DDS:
+		if (encode_applies(fmt)) {
+			ret = expand_image_content(file, fmt);
+			if (ret < 0)
+				return ret;
+
+			start = trace_begin();
+			ret = encode_image(file);
+			if (ret < 0) {
+				fprintf(stderr, "Error during DXT compression of texture\n");
+				return ret;
+			}
+			trace_end(file, "encode", start);
 		}
 
-		return resize_image_bmp(file);
-	case GR_TEXFMT_ARGB_CMP_FXT1:
-		fprintf(stderr, "Unsupported format GR_TEXFMT_ARGB_CMP_FXT1\n");
-		return -EPERM;
-	case GR_TEXFMT_ARGB_8888:
-		return resize_image_bmp(file);
-	case GR_TEXFMT_ARGB_CMP_DXT1:
-	case GR_TEXFMT_ARGB_CMP_DXT3:
-	case GR_TEXFMT_ARGB_CMP_DXT5:
-		return resize_image_dds(file);
+		start = trace_begin();
+		ret = resize_image_dds(file);
+		trace_end(file, "wrap", start);
+
+		return ret;
 	default:
-		fprintf(stderr, "Unsupported format %x\n", file->format);
+		fprintf(stderr, "Unsupported format GR_TEXFMT_%s\n", fmt->name);
 		return -EPERM;
 	}
+}
 
-	return 0;
+size_t output_content_length(const struct glide64_file *file)
+{
+	const struct texture_format *fmt;
+	size_t width, height;
+
+	fmt = texture_format_get(file->format & ~GR_TEXFMT_GZ);
+	if (!fmt)
+		return 0;
+
+	if (untile_applies(file)) {
+		width = file->untiled_width;
+		height = file->untiled_height;
+	} else {
+		width = file->width;
+		height = file->height;
+	}
+
+	switch (texture_container_get(fmt)) {
+	case CONTAINER_BMP:
+		/* upper bound, --reduce only writes smaller bitmaps */
+		if (globals.bitmapv5)
+			return width * height * 4 + sizeof(struct bmp_header_v5);
+		else
+			return width * height * 4 + sizeof(struct bmp_header);
+	case CONTAINER_DDS:
+		/* upper bound, opaque textures only need half of it as DXT1 */
+		if (encode_applies(fmt))
+			return ((width + 3) / 4) * ((height + 3) / 4) * 16 + sizeof(DDS_HEADER);
+
+		return image_content_length(file) + sizeof(DDS_HEADER);
+	default:
+		return 0;
+	}
 }
 
-int prepare_file(struct glide64_file *file)
+/* the formats chosen by encode_image and --reduce depend on the pixels and
+ * not only on the header. output_content_length only returns an upper bound
+ * for these
+ */
+int output_length_exact(const struct glide64_file *file)
+{
+	const struct texture_format *fmt;
+
+	fmt = texture_format_get(file->format & ~GR_TEXFMT_GZ);
+	if (!fmt)
+		return 1;
+
+	switch (texture_container_get(fmt)) {
+	case CONTAINER_BMP:
+		return !globals.reduce;
+	case CONTAINER_DDS:
+		return !encode_applies(fmt);
+	default:
+		return 1;
+	}
+}
+
+int file_passthrough(const struct glide64_file *file)
+{
+	const struct texture_format *fmt;
+
+	if (file->format & GR_TEXFMT_GZ)
+		return 0;
+
+	/* zip entries need the crc of the content before it is written */
+	if (globals.archive != ARCHIVE_TAR)
+		return 0;
+
+	/* the store names files after the hash of their content */
+	if (globals.store_dir)
+		return 0;
+
+	fmt = texture_format_get(file->format);
+	if (!fmt)
+		return 0;
+
+	switch (texture_container_get(fmt)) {
+	case CONTAINER_BMP:
+		/* only top-down ARGB_8888 rows match the bitmap pixel data */
+		return globals.top_down && !globals.reduce && !fmt->expand &&
+		       !untile_applies(file);
+	case CONTAINER_DDS:
+		return !encode_applies(fmt);
+	default:
+		return 0;
+	}
+}
+
+static int inflate_file(struct glide64_file *file)
 {
 	size_t expected_size;
+	uint64_t start;
 	void *buf;
 	uLongf destLen;
 	int ret;
@@ -786,7 +1173,9 @@ int prepare_file(struct glide64_file *file)
 			return -ENOMEM;
 		}
 
+		start = trace_begin();
 		ret = uncompress(buf, &destLen, file->data, file->size);
+		trace_end(file, "inflate", start);
 		if (ret != Z_OK) {
 			free(buf);
 			fprintf(stderr, "Failure during decompressing\n");
@@ -810,11 +1199,295 @@ int prepare_file(struct glide64_file *file)
 		}
 	}
 
+	return 0;
+}
+
+int prepare_file(struct glide64_file *file)
+{
+	int ret;
+
+	if (store_check(file))
+		return 0;
+
+	ret = inflate_file(file);
+	if (ret < 0)
+		return ret;
+
 	ret = resize_image_content(file);
 	if (ret < 0) {
 		fprintf(stderr, "Failed to prepare image content\n");
 		return ret;
 	}
 
+	if (globals.archive != ARCHIVE_TAR)
+		return zip_prepare(file);
+
+	if (globals.store_dir)
+		return store_hash(file);
+
+	return 0;
+}
+
+int normalize_file(struct glide64_file *file)
+{
+	const struct texture_format *fmt;
+	int ret;
+
+	ret = inflate_file(file);
+	if (ret < 0)
+		return ret;
+
+	fmt = texture_format_get(file->format);
+	if (!fmt || (!fmt->expand && file->format != GR_TEXFMT_ARGB_8888))
+		return -EPERM;
+
+	return expand_image_content(file, fmt);
+}
+
+int wrap_bitmap(struct glide64_file *file)
+{
+	int ret;
+
+	ret = resize_image_bmp(file);
+	if (ret < 0)
+		return ret;
+
+	if (globals.archive != ARCHIVE_TAR)
+		return zip_prepare(file);
+
+	return 0;
+}
+
+const struct texture_format *texture_format_find(const char *name)
+{
+	const struct texture_format *fmt;
+	size_t i;
+
+	if (strncasecmp(name, "GR_TEXFMT_", strlen("GR_TEXFMT_")) == 0)
+		name += strlen("GR_TEXFMT_");
+
+	for (i = 0; i < sizeof(texture_formats) / sizeof(texture_formats[0]); i++) {
+		fmt = texture_format_get((uint16_t)i);
+		if (fmt && strcasecmp(fmt->name, name) == 0)
+			return fmt;
+	}
+
+	return NULL;
+}
+
+uint16_t texture_format_id(const struct texture_format *fmt)
+{
+	return (uint16_t)(fmt - texture_formats);
+}
+
+/* 32, 24 and 8 bit bitmaps as written by resize_image_bmp are decoded to
+ * ARGB_8888 rows in the order of the cache
+ */
+static int decode_image_bmp(struct glide64_file *file)
+{
+	const uint8_t *data = file->data;
+	const uint8_t *palette = NULL;
+	const uint8_t *source_pos;
+	struct bmp_header header;
+	uint32_t width, height, dataofs, headersize, compression, colors = 0;
+	uint32_t masks[3];
+	uint32_t *buf;
+	uint32_t x, y, row, index;
+	uint16_t bitcount;
+	size_t line_size;
+	int top_down = 0;
+
+	if (file->size < sizeof(header))
+		return -EINVAL;
+
+	memcpy(&header, data, sizeof(header));
+	dataofs = le32toh(header.dataofs);
+	headersize = le32toh(header.headersize);
+	width = le32toh(header.width);
+	height = le32toh(header.height);
+	bitcount = le16toh((uint16_t)header.bitperpixel);
+	compression = le32toh(header.compression);
+
+	/* negative height marks rows which are stored top-down */
+	if ((int32_t)height < 0) {
+		height = (uint32_t)-(int32_t)height;
+		top_down = 1;
+	}
+
+	if (headersize < 40 || !width || !height || height > INT32_MAX ||
+	    (uint64_t)width * height > UINT32_MAX / 4)
+		return -EINVAL;
+
+	if (compression == 3 && bitcount == 32) {
+		/* only the channel layout written by --bitmapv5 is supported */
+		if ((uint64_t)14 + 40 + sizeof(masks) > file->size)
+			return -EINVAL;
+
+		memcpy(masks, data + 14 + 40, sizeof(masks));
+		if (le32toh(masks[0]) != 0x00ff0000U ||
+		    le32toh(masks[1]) != 0x0000ff00U ||
+		    le32toh(masks[2]) != 0x000000ffU)
+			return -EPERM;
+	} else if (compression != 0) {
+		return -EPERM;
+	}
+
+	switch (bitcount) {
+	case 8:
+		colors = le32toh(header.colors);
+		if (!colors || colors > 256)
+			colors = 256;
+
+		palette = data + 14 + headersize;
+		if ((uint64_t)14 + headersize + colors * 4 > file->size)
+			return -EINVAL;
+		break;
+	case 24:
+	case 32:
+		break;
+	default:
+		return -EPERM;
+	}
+
+	/* each line is padded to 4 bytes */
+	line_size = ((size_t)width * (bitcount / 8) + 3) & ~(size_t)3;
+	if ((uint64_t)dataofs + (uint64_t)line_size * height > file->size)
+		return -EINVAL;
+
+	buf = malloc((size_t)width * height * 4);
+	if (!buf) {
+		fprintf(stderr, "Memory for BMP image content couldn't be allocated\n");
+		return -ENOMEM;
+	}
+
+	for (y = 0; y < height; y++) {
+		row = top_down ? y : height - y - 1;
+		source_pos = data + dataofs + (size_t)row * line_size;
+
+		for (x = 0; x < width; x++) {
+			uint32_t *target = &buf[(size_t)y * width + x];
+			const uint8_t *color;
+
+			switch (bitcount) {
+			case 32:
+				memcpy(target, &source_pos[x * 4], 4);
+				break;
+			case 24:
+				color = &source_pos[x * 3];
+				*target = htole32(0xff000000U | (uint32_t)color[2] << 16 |
+						  (uint32_t)color[1] << 8 | color[0]);
+				break;
+			default:
+				index = source_pos[x];
+				if (index >= colors) {
+					free(buf);
+					return -EINVAL;
+				}
+
+				color = &palette[index * 4];
+				*target = htole32(0xff000000U | (uint32_t)color[2] << 16 |
+						  (uint32_t)color[1] << 8 | color[0]);
+				break;
+			}
+		}
+	}
+
+	free(file->data);
+	file->data = buf;
+	file->width = width;
+	file->height = height;
+	file->size = width * height * 4;
+	file->format = GR_TEXFMT_ARGB_8888;
+
+	return 0;
+}
+
+/* DDS files keep the stored layout of the format described by the header */
+static int decode_image_dds(struct glide64_file *file)
+{
+	const struct texture_format *fmt = NULL;
+	DDS_HEADER header;
+	uint32_t pf_flags;
+	size_t header_size = 128;
+	size_t data_size;
+	size_t i;
+
+	if (file->size < header_size)
+		return -EINVAL;
+
+	memcpy(&header, file->data, sizeof(header));
+	pf_flags = le32toh(header.ddspf.dwFlags);
+
+	for (i = 0; i < sizeof(texture_formats) / sizeof(texture_formats[0]); i++) {
+		fmt = texture_format_get((uint16_t)i);
+		if (!fmt || !fmt->dds_pf_flags || fmt->dds_pf_flags != pf_flags)
+			continue;
+
+		if (pf_flags & DDPF_FOURCC) {
+			if (le32toh(header.ddspf.dwFourCC) == fmt->dds_fourcc)
+				break;
+			continue;
+		}
+
+		if (le32toh(header.ddspf.dwRGBBitCount) == fmt->dds_bitcount &&
+		    le32toh(header.ddspf.dwRBitMask) == fmt->dds_rmask &&
+		    le32toh(header.ddspf.dwGBitMask) == fmt->dds_gmask &&
+		    le32toh(header.ddspf.dwBBitMask) == fmt->dds_bmask &&
+		    le32toh(header.ddspf.dwABitMask) == fmt->dds_amask)
+			break;
+	}
+
+	if (i == sizeof(texture_formats) / sizeof(texture_formats[0]))
+		return -EPERM;
+
+	file->width = le32toh(header.dwWidth);
+	file->height = le32toh(header.dwHeight);
+	file->format = (uint16_t)i;
+
+	data_size = image_content_length(file);
+	if (!file->width || !file->height || data_size > file->size - header_size)
+		return -EINVAL;
+
+	memmove(file->data, (uint8_t *)file->data + header_size, data_size);
+	file->size = (uint32_t)data_size;
+
+	return 0;
+}
+
+int decode_image(struct glide64_file *file)
+{
+	const uint8_t *data = file->data;
+
+	if (file->size >= 4 && memcmp(data, "DDS ", 4) == 0)
+		return decode_image_dds(file);
+
+	if (file->size >= 2 && memcmp(data, "BM", 2) == 0)
+		return decode_image_bmp(file);
+
+	return -EPERM;
+}
+
+/* ARGB_8888 content is converted to the layout of the given format */
+int pack_file(struct glide64_file *file, const struct texture_format *fmt)
+{
+	size_t pixels = (size_t)file->width * file->height;
+	void *buf;
+
+	if (file->format != GR_TEXFMT_ARGB_8888 || !fmt->pack)
+		return 0;
+
+	buf = malloc(pixels * fmt->bits_per_pixel / 8);
+	if (!buf) {
+		fprintf(stderr, "Memory for %s image content couldn't be allocated\n", fmt->name);
+		return -ENOMEM;
+	}
+
+	fmt->pack(buf, file->data, pixels);
+
+	free(file->data);
+	file->data = buf;
+	file->size = (uint32_t)(pixels * fmt->bits_per_pixel / 8);
+	file->format = texture_format_id(fmt);
+
 	return 0;
 }
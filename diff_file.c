@@ -0,0 +1,316 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* glide64_cache_extract, Glide64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+#include "glide64_cache_extract.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/* Only the headers of both caches are read to build tables sorted by
+ * checksum. Payloads are only compared when the checksum and the headers
+ * of a record match in both caches.
+ */
+
+#define DIFF_CHUNK_SIZE	(64 * 1024)
+
+struct diff_entry {
+	uint64_t checksum;
+	uint64_t offset;
+	off_t payload_pos;
+	uint32_t width;
+	uint32_t height;
+	uint32_t size;
+	uint16_t format;
+};
+
+struct diff_table {
+	struct diff_entry *entries;
+	size_t count;
+	size_t alloc;
+};
+
+static struct {
+	uint64_t added;
+	uint64_t removed;
+	uint64_t changed;
+	uint64_t unchanged;
+} diff;
+
+static int compare_checksum(const void *a, const void *b)
+{
+	const struct diff_entry *entry_a = a;
+	const struct diff_entry *entry_b = b;
+
+	if (entry_a->checksum != entry_b->checksum)
+		return entry_a->checksum < entry_b->checksum ? -1 : 1;
+
+	if (entry_a->offset != entry_b->offset)
+		return entry_a->offset < entry_b->offset ? -1 : 1;
+
+	return 0;
+}
+
+static int compare_offset(const void *a, const void *b)
+{
+	const struct diff_entry *entry_a = a;
+	const struct diff_entry *entry_b = b;
+
+	if (entry_a->offset != entry_b->offset)
+		return entry_a->offset < entry_b->offset ? -1 : 1;
+
+	return 0;
+}
+
+static int read_table(struct diff_table *table)
+{
+	struct diff_entry *entry, *tmp;
+	struct glide64_file file;
+	uint32_t config;
+	int ret;
+
+	globals.in_offset = 0;
+
+	ret = get_item(config);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to read config header\n");
+		return ret;
+	}
+
+	ret = parse_config(config);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to parse config header\n");
+		return ret;
+	}
+
+	while (1) {
+		ret = read_file_header(&file);
+		if (ret > 0)
+			break;
+		if (ret < 0)
+			return ret;
+
+		if (table->count == table->alloc) {
+			table->alloc = table->alloc ? table->alloc * 2 : 1024;
+			tmp = realloc(table->entries, table->alloc * sizeof(*table->entries));
+			if (!tmp) {
+				fprintf(stderr, "Could not allocate memory for diff table\n");
+				return -ENOMEM;
+			}
+			table->entries = tmp;
+		}
+
+		entry = &table->entries[table->count++];
+		entry->checksum = file.checksum;
+		entry->offset = file.offset;
+		entry->payload_pos = ftello(globals.in);
+		entry->width = file.width;
+		entry->height = file.height;
+		entry->size = file.size;
+		entry->format = file.format;
+
+		if (entry->payload_pos < 0 || fseeko(globals.in, file.size, SEEK_CUR) < 0) {
+			fprintf(stderr, "Could not skip file content\n");
+			return -EIO;
+		}
+		globals.in_offset += file.size;
+	}
+
+	qsort(table->entries, table->count, sizeof(*table->entries), compare_checksum);
+
+	return 0;
+}
+
+static int open_table(const char *path, FILE **in, struct diff_table *table)
+{
+	struct stat st;
+
+	*in = fopen(path, "rb");
+	if (!*in) {
+		fprintf(stderr, "Could not open input file %s\n", path);
+		return -ENOENT;
+	}
+
+	if (fstat(fileno(*in), &st) < 0 || !S_ISREG(st.st_mode)) {
+		fprintf(stderr, "Diff requires seekable input files\n");
+		return -EINVAL;
+	}
+
+	globals.in = *in;
+
+	return read_table(table);
+}
+
+static int payload_equal(int fd_a, const struct diff_entry *a,
+			 int fd_b, const struct diff_entry *b)
+{
+	static uint8_t buf_a[DIFF_CHUNK_SIZE];
+	static uint8_t buf_b[DIFF_CHUNK_SIZE];
+	size_t pos, len;
+
+	for (pos = 0; pos < a->size; pos += len) {
+		len = a->size - pos;
+		if (len > DIFF_CHUNK_SIZE)
+			len = DIFF_CHUNK_SIZE;
+
+		if (pread(fd_a, buf_a, len, a->payload_pos + pos) != (ssize_t)len ||
+		    pread(fd_b, buf_b, len, b->payload_pos + pos) != (ssize_t)len) {
+			fprintf(stderr, "Could not read file content\n");
+			return -EIO;
+		}
+
+		if (memcmp(buf_a, buf_b, len) != 0)
+			return 0;
+	}
+
+	return 1;
+}
+
+static const char *format_name(uint16_t format)
+{
+	const struct texture_format *fmt;
+
+	fmt = texture_format_get(format & ~GR_TEXFMT_GZ);
+	if (!fmt)
+		return "unknown";
+
+	return fmt->name;
+}
+
+static void report(char type, const struct diff_entry *entry)
+{
+	printf("%c %016"PRIX64" %s%s %"PRIu32"x%"PRIu32"\n", type, entry->checksum,
+	       format_name(entry->format),
+	       entry->format & GR_TEXFMT_GZ ? "+gz" : "", entry->width,
+	       entry->height);
+}
+
+static int headers_equal(const struct diff_entry *a, const struct diff_entry *b)
+{
+	return a->format == b->format && a->width == b->width &&
+	       a->height == b->height && a->size == b->size;
+}
+
+static int extract_changed(struct diff_entry *changed, size_t count)
+{
+	size_t i;
+	int ret;
+
+	/* read the new cache sequentially */
+	qsort(changed, count, sizeof(*changed), compare_offset);
+
+	for (i = 0; i < count; i++) {
+		if (fseeko(globals.in, changed[i].offset, SEEK_SET) < 0) {
+			fprintf(stderr, "Could not seek to record\n");
+			return -EIO;
+		}
+		globals.in_offset = changed[i].offset;
+
+		ret = convert_file();
+		if (ret < 0)
+			return ret;
+	}
+
+	/* pending records may still reference the input file */
+	return pipeline_flush();
+}
+
+int diff_caches(const char *path_a, const char *path_b, int extract)
+{
+	struct diff_table table_a = { 0 }, table_b = { 0 };
+	struct diff_entry *changed = NULL;
+	FILE *in_a = NULL, *in_b = NULL;
+	size_t changed_count = 0;
+	size_t i = 0, j = 0;
+	int equal;
+	int ret;
+
+	ret = open_table(path_a, &in_a, &table_a);
+	if (ret < 0)
+		goto out;
+
+	ret = open_table(path_b, &in_b, &table_b);
+	if (ret < 0)
+		goto out;
+
+	changed = malloc((table_b.count ? table_b.count : 1) * sizeof(*changed));
+	if (!changed) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	while (i < table_a.count || j < table_b.count) {
+		if (j == table_b.count ||
+		    (i < table_a.count && table_a.entries[i].checksum < table_b.entries[j].checksum)) {
+			report('-', &table_a.entries[i]);
+			diff.removed++;
+			i++;
+			continue;
+		}
+
+		if (i == table_a.count ||
+		    table_b.entries[j].checksum < table_a.entries[i].checksum) {
+			report('+', &table_b.entries[j]);
+			diff.added++;
+			changed[changed_count++] = table_b.entries[j];
+			j++;
+			continue;
+		}
+
+		equal = headers_equal(&table_a.entries[i], &table_b.entries[j]);
+		if (equal) {
+			equal = payload_equal(fileno(in_a), &table_a.entries[i],
+					      fileno(in_b), &table_b.entries[j]);
+			if (equal < 0) {
+				ret = equal;
+				goto out;
+			}
+		}
+
+		if (equal) {
+			diff.unchanged++;
+		} else {
+			report('~', &table_b.entries[j]);
+			diff.changed++;
+			changed[changed_count++] = table_b.entries[j];
+		}
+
+		i++;
+		j++;
+	}
+
+	if (extract)
+		ret = extract_changed(changed, changed_count);
+
+out:
+	free(changed);
+	free(table_b.entries);
+	free(table_a.entries);
+	if (in_a)
+		fclose(in_a);
+	if (in_b)
+		fclose(in_b);
+	globals.in = NULL;
+
+	return ret;
+}
+
+int diff_summary(void)
+{
+	fprintf(stderr, "%"PRIu64" added, %"PRIu64" removed, %"PRIu64" changed, %"PRIu64" unchanged\n",
+		diff.added, diff.removed, diff.changed, diff.unchanged);
+
+	if (diff.added || diff.removed || diff.changed)
+		return -EINVAL;
+
+	return 0;
+}
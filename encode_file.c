@@ -0,0 +1,576 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* glide64_cache_extract, Glide64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+#include "glide64_cache_extract.h"
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Normalized ARGB_8888 textures are compressed to DXT1 when all pixels
+ * are opaque and to DXT5 otherwise. The fast mode uses the (inset)
+ * bounding box of each block as color endpoints. The high quality mode
+ * additionally tries the principal axis of the block and refines the
+ * endpoints with a least squares fit of the selected indices.
+ */
+
+#define DXT_REFINE_STEPS	2
+#define DXT_POWER_STEPS		4
+
+struct color_block {
+	int16_t px[16][4] __attribute__((aligned(16)));
+	uint8_t alpha[16];
+};
+
+struct color_endpoints {
+	int c[2][3];
+};
+
+static void load_block(struct color_block *block, const uint8_t *src,
+		       uint32_t width, uint32_t height, uint32_t bx, uint32_t by)
+{
+	const uint8_t *pixel;
+	uint32_t x, y;
+	size_t i;
+
+	/* partial blocks at the border repeat the last column/row */
+	for (i = 0; i < 16; i++) {
+		x = bx + i % 4;
+		y = by + i / 4;
+		if (x >= width)
+			x = width - 1;
+		if (y >= height)
+			y = height - 1;
+
+		pixel = src + ((size_t)y * width + x) * 4;
+		block->px[i][0] = pixel[2];
+		block->px[i][1] = pixel[1];
+		block->px[i][2] = pixel[0];
+		block->px[i][3] = 0;
+		block->alpha[i] = pixel[3];
+	}
+}
+
+static int clamp_channel(int value)
+{
+	if (value < 0)
+		return 0;
+	if (value > 255)
+		return 255;
+
+	return value;
+}
+
+static uint16_t pack_565(const int c[3])
+{
+	uint16_t r = (c[0] * 31 + 127) / 255;
+	uint16_t g = (c[1] * 63 + 127) / 255;
+	uint16_t b = (c[2] * 31 + 127) / 255;
+
+	return (r << 11) | (g << 5) | b;
+}
+
+static void unpack_565(uint16_t color, int16_t c[4])
+{
+	int r = (color >> 11) & 0x1f;
+	int g = (color >> 5) & 0x3f;
+	int b = color & 0x1f;
+
+	c[0] = (r << 3) | (r >> 2);
+	c[1] = (g << 2) | (g >> 4);
+	c[2] = (b << 3) | (b >> 2);
+	c[3] = 0;
+}
+
+/* squared distance of all pixels to all four palette entries */
+static void palette_distances(const struct color_block *block,
+			      const int16_t palette[4][4], int32_t dist[4][16])
+{
+	size_t i, k;
+
+#ifdef __SSE2__
+	int32_t sums[4] __attribute__((aligned(16)));
+	__m128i entry, pixels, diff, sq;
+
+	for (k = 0; k < 4; k++) {
+		entry = _mm_set_epi16(0, palette[k][2], palette[k][1], palette[k][0],
+				      0, palette[k][2], palette[k][1], palette[k][0]);
+
+		for (i = 0; i < 16; i += 2) {
+			pixels = _mm_load_si128((const __m128i *)block->px[i]);
+			diff = _mm_sub_epi16(pixels, entry);
+			sq = _mm_madd_epi16(diff, diff);
+			sq = _mm_add_epi32(sq, _mm_shuffle_epi32(sq, _MM_SHUFFLE(2, 3, 0, 1)));
+			_mm_store_si128((__m128i *)sums, sq);
+
+			dist[k][i] = sums[0];
+			dist[k][i + 1] = sums[2];
+		}
+	}
+#else
+	int32_t d;
+	size_t c;
+
+	for (k = 0; k < 4; k++) {
+		for (i = 0; i < 16; i++) {
+			dist[k][i] = 0;
+			for (c = 0; c < 3; c++) {
+				d = block->px[i][c] - palette[k][c];
+				dist[k][i] += d * d;
+			}
+		}
+	}
+#endif
+}
+
+static uint64_t match_colors(const struct color_block *block, uint16_t c0,
+			     uint16_t c1, uint8_t indices[16])
+{
+	int16_t palette[4][4] __attribute__((aligned(16)));
+	int32_t dist[4][16];
+	uint64_t error = 0;
+	size_t i, k, best;
+
+	unpack_565(c0, palette[0]);
+	unpack_565(c1, palette[1]);
+	for (i = 0; i < 3; i++) {
+		palette[2][i] = (2 * palette[0][i] + palette[1][i]) / 3;
+		palette[3][i] = (palette[0][i] + 2 * palette[1][i]) / 3;
+	}
+	palette[2][3] = 0;
+	palette[3][3] = 0;
+
+	palette_distances(block, (const int16_t (*)[4])palette, dist);
+
+	for (i = 0; i < 16; i++) {
+		best = 0;
+		for (k = 1; k < 4; k++) {
+			if (dist[k][i] < dist[best][i])
+				best = k;
+		}
+
+		indices[i] = best;
+		error += dist[best][i];
+	}
+
+	return error;
+}
+
+static uint64_t encode_endpoints(const struct color_block *block,
+				 const struct color_endpoints *ends,
+				 uint16_t *c0, uint16_t *c1, uint8_t indices[16])
+{
+	uint16_t tmp;
+
+	*c0 = pack_565(ends->c[0]);
+	*c1 = pack_565(ends->c[1]);
+
+	/* four color mode requires c0 > c1 */
+	if (*c0 < *c1) {
+		tmp = *c0;
+		*c0 = *c1;
+		*c1 = tmp;
+	}
+
+	/* equal endpoints select index 0 for all pixels because every palette
+	 * entry has the same distance
+	 */
+	return match_colors(block, *c0, *c1, indices);
+}
+
+static void bounding_box(const struct color_block *block,
+			 struct color_endpoints *ends)
+{
+	int min[3] = { 255, 255, 255 };
+	int max[3] = { 0, 0, 0 };
+	int mean[3] = { 0, 0, 0 };
+	int cov_rg = 0, cov_rb = 0;
+	int inset, tmp;
+	size_t i, c;
+
+	for (i = 0; i < 16; i++) {
+		for (c = 0; c < 3; c++) {
+			if (block->px[i][c] < min[c])
+				min[c] = block->px[i][c];
+			if (block->px[i][c] > max[c])
+				max[c] = block->px[i][c];
+			mean[c] += block->px[i][c];
+		}
+	}
+
+	for (c = 0; c < 3; c++)
+		mean[c] = (mean[c] + 8) / 16;
+
+	/* pick the box diagonal which follows the color gradient */
+	for (i = 0; i < 16; i++) {
+		cov_rg += (block->px[i][0] - mean[0]) * (block->px[i][1] - mean[1]);
+		cov_rb += (block->px[i][0] - mean[0]) * (block->px[i][2] - mean[2]);
+	}
+
+	if (cov_rg < 0) {
+		tmp = min[1];
+		min[1] = max[1];
+		max[1] = tmp;
+	}
+
+	if (cov_rb < 0) {
+		tmp = min[2];
+		min[2] = max[2];
+		max[2] = tmp;
+	}
+
+	/* move the endpoints inwards to reduce the error of the inner colors */
+	for (c = 0; c < 3; c++) {
+		inset = (max[c] - min[c]) / 16;
+		ends->c[0][c] = clamp_channel(max[c] - inset);
+		ends->c[1][c] = clamp_channel(min[c] + inset);
+	}
+}
+
+static float abs_float(float value)
+{
+	return value < 0.0f ? -value : value;
+}
+
+static void principal_axis(const struct color_block *block,
+			   struct color_endpoints *ends)
+{
+	float mean[3] = { 0.0f, 0.0f, 0.0f };
+	float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+	float axis[3] = { 1.0f, 1.0f, 1.0f };
+	float d[3], next[3], len, proj;
+	float min_proj = 0.0f, max_proj = 0.0f;
+	size_t min_i = 0, max_i = 0;
+	size_t i, c, step;
+
+	for (i = 0; i < 16; i++) {
+		for (c = 0; c < 3; c++)
+			mean[c] += block->px[i][c];
+	}
+
+	for (c = 0; c < 3; c++)
+		mean[c] /= 16.0f;
+
+	for (i = 0; i < 16; i++) {
+		for (c = 0; c < 3; c++)
+			d[c] = block->px[i][c] - mean[c];
+
+		cov[0] += d[0] * d[0];
+		cov[1] += d[0] * d[1];
+		cov[2] += d[0] * d[2];
+		cov[3] += d[1] * d[1];
+		cov[4] += d[1] * d[2];
+		cov[5] += d[2] * d[2];
+	}
+
+	for (step = 0; step < DXT_POWER_STEPS; step++) {
+		next[0] = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+		next[1] = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+		next[2] = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+
+		if (next[0] * next[0] + next[1] * next[1] + next[2] * next[2] < 1e-6f)
+			break;
+
+		for (c = 0; c < 3; c++)
+			axis[c] = next[c];
+
+		/* keep the values in range, the length is irrelevant */
+		len = abs_float(next[0]);
+		if (abs_float(next[1]) > len)
+			len = abs_float(next[1]);
+		if (abs_float(next[2]) > len)
+			len = abs_float(next[2]);
+		for (c = 0; c < 3; c++)
+			axis[c] /= len;
+	}
+
+	for (i = 0; i < 16; i++) {
+		proj = 0.0f;
+		for (c = 0; c < 3; c++)
+			proj += (block->px[i][c] - mean[c]) * axis[c];
+
+		if (i == 0 || proj < min_proj) {
+			min_proj = proj;
+			min_i = i;
+		}
+
+		if (i == 0 || proj > max_proj) {
+			max_proj = proj;
+			max_i = i;
+		}
+	}
+
+	for (c = 0; c < 3; c++) {
+		ends->c[0][c] = block->px[max_i][c];
+		ends->c[1][c] = block->px[min_i][c];
+	}
+}
+
+/* least squares fit of the endpoints for the given palette indices */
+static int refine_endpoints(const struct color_block *block, uint16_t c0,
+			    uint16_t c1, const uint8_t indices[16],
+			    struct color_endpoints *ends)
+{
+	static const int weights[4] = { 3, 0, 2, 1 };
+	float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+	float ax[3] = { 0.0f, 0.0f, 0.0f };
+	float bx[3] = { 0.0f, 0.0f, 0.0f };
+	float alpha, beta, det;
+	size_t i, c;
+
+	if (c0 == c1)
+		return 0;
+
+	for (i = 0; i < 16; i++) {
+		alpha = weights[indices[i]] / 3.0f;
+		beta = 1.0f - alpha;
+
+		aa += alpha * alpha;
+		bb += beta * beta;
+		ab += alpha * beta;
+		for (c = 0; c < 3; c++) {
+			ax[c] += alpha * block->px[i][c];
+			bx[c] += beta * block->px[i][c];
+		}
+	}
+
+	det = aa * bb - ab * ab;
+	if (det < 1e-6f && det > -1e-6f)
+		return 0;
+
+	for (c = 0; c < 3; c++) {
+		ends->c[0][c] = clamp_channel((int)((ax[c] * bb - bx[c] * ab) / det + 0.5f));
+		ends->c[1][c] = clamp_channel((int)((bx[c] * aa - ax[c] * ab) / det + 0.5f));
+	}
+
+	return 1;
+}
+
+static void put_color_block(uint8_t *dst, uint16_t c0, uint16_t c1,
+			    const uint8_t indices[16])
+{
+	uint32_t bits = 0;
+	size_t i;
+
+	for (i = 0; i < 16; i++)
+		bits |= (uint32_t)indices[i] << (2 * i);
+
+	dst[0] = c0 & 0xff;
+	dst[1] = c0 >> 8;
+	dst[2] = c1 & 0xff;
+	dst[3] = c1 >> 8;
+	dst[4] = bits & 0xff;
+	dst[5] = (bits >> 8) & 0xff;
+	dst[6] = (bits >> 16) & 0xff;
+	dst[7] = bits >> 24;
+}
+
+static void encode_color(const struct color_block *block, uint8_t *dst)
+{
+	struct color_endpoints ends;
+	uint8_t indices[16], best_indices[16];
+	uint16_t c0, c1, best_c0, best_c1;
+	uint64_t error, best_error;
+	size_t step;
+
+	bounding_box(block, &ends);
+	best_error = encode_endpoints(block, &ends, &best_c0, &best_c1, best_indices);
+
+	if (globals.encode == ENCODE_HQ && best_error) {
+		principal_axis(block, &ends);
+		error = encode_endpoints(block, &ends, &c0, &c1, indices);
+		if (error < best_error) {
+			best_error = error;
+			best_c0 = c0;
+			best_c1 = c1;
+			memcpy(best_indices, indices, sizeof(indices));
+		}
+
+		for (step = 0; step < DXT_REFINE_STEPS && best_error; step++) {
+			if (!refine_endpoints(block, best_c0, best_c1, best_indices, &ends))
+				break;
+
+			error = encode_endpoints(block, &ends, &c0, &c1, indices);
+			if (error >= best_error)
+				break;
+
+			best_error = error;
+			best_c0 = c0;
+			best_c1 = c1;
+			memcpy(best_indices, indices, sizeof(indices));
+		}
+	}
+
+	put_color_block(dst, best_c0, best_c1, best_indices);
+}
+
+static uint32_t match_alpha(const struct color_block *block,
+			    const int palette[8], uint8_t indices[16])
+{
+	uint32_t error = 0;
+	int d, best_d;
+	size_t i, k;
+
+	for (i = 0; i < 16; i++) {
+		indices[i] = 0;
+		best_d = abs(block->alpha[i] - palette[0]);
+		for (k = 1; k < 8; k++) {
+			d = abs(block->alpha[i] - palette[k]);
+			if (d < best_d) {
+				best_d = d;
+				indices[i] = k;
+			}
+		}
+
+		error += best_d * best_d;
+	}
+
+	return error;
+}
+
+static uint32_t alpha_palette8(const struct color_block *block, int a0, int a1,
+			       uint8_t indices[16])
+{
+	int palette[8];
+	size_t i;
+
+	palette[0] = a0;
+	palette[1] = a1;
+	for (i = 1; i < 7; i++)
+		palette[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+
+	return match_alpha(block, palette, indices);
+}
+
+static uint32_t alpha_palette6(const struct color_block *block, int a0, int a1,
+			       uint8_t indices[16])
+{
+	int palette[8];
+	size_t i;
+
+	palette[0] = a0;
+	palette[1] = a1;
+	for (i = 1; i < 5; i++)
+		palette[i + 1] = ((5 - i) * a0 + i * a1) / 5;
+	palette[6] = 0;
+	palette[7] = 255;
+
+	return match_alpha(block, palette, indices);
+}
+
+static void put_alpha_block(uint8_t *dst, int a0, int a1,
+			    const uint8_t indices[16])
+{
+	uint64_t bits = 0;
+	size_t i;
+
+	for (i = 0; i < 16; i++)
+		bits |= (uint64_t)indices[i] << (3 * i);
+
+	dst[0] = a0;
+	dst[1] = a1;
+	for (i = 0; i < 6; i++)
+		dst[2 + i] = (bits >> (8 * i)) & 0xff;
+}
+
+static void encode_alpha(const struct color_block *block, uint8_t *dst)
+{
+	uint8_t indices[16], indices6[16];
+	int min = 255, max = 0;
+	int min6 = 255, max6 = 0;
+	uint32_t error;
+	size_t i;
+
+	for (i = 0; i < 16; i++) {
+		if (block->alpha[i] < min)
+			min = block->alpha[i];
+		if (block->alpha[i] > max)
+			max = block->alpha[i];
+
+		if (block->alpha[i] != 0 && block->alpha[i] < min6)
+			min6 = block->alpha[i];
+		if (block->alpha[i] != 255 && block->alpha[i] > max6)
+			max6 = block->alpha[i];
+	}
+
+	if (min == max) {
+		memset(indices, 0, sizeof(indices));
+		put_alpha_block(dst, max, min, indices);
+		return;
+	}
+
+	error = alpha_palette8(block, max, min, indices);
+
+	/* the six value mode has exact 0 and 255 for cut-out textures */
+	if (globals.encode == ENCODE_HQ && error && min6 <= max6) {
+		if (min6 == max6 && min6 > 0)
+			min6--;
+		if (min6 == max6)
+			max6++;
+
+		if (alpha_palette6(block, min6, max6, indices6) < error) {
+			put_alpha_block(dst, min6, max6, indices6);
+			return;
+		}
+	}
+
+	put_alpha_block(dst, max, min, indices);
+}
+
+int encode_image(struct glide64_file *file)
+{
+	struct color_block block;
+	uint32_t bx, by;
+	size_t block_size, newsize;
+	uint8_t *buf, *dst;
+	int opaque;
+
+	if (file->format != GR_TEXFMT_ARGB_8888) {
+		fprintf(stderr, "Unsupported texture format %#x for DXT compression\n", file->format);
+		return -EPERM;
+	}
+
+	opaque = image_opaque(file->data, (size_t)file->width * file->height);
+	block_size = opaque ? 8 : 16;
+
+	newsize = (size_t)((file->width + 3) / 4) * ((file->height + 3) / 4) * block_size;
+	if (newsize > UINT32_MAX)
+		return -EINVAL;
+
+	buf = malloc(newsize);
+	if (!buf) {
+		fprintf(stderr, "Memory for DXT compressed image couldn't be allocated\n");
+		return -ENOMEM;
+	}
+
+	dst = buf;
+	for (by = 0; by < file->height; by += 4) {
+		for (bx = 0; bx < file->width; bx += 4) {
+			load_block(&block, file->data, file->width, file->height, bx, by);
+
+			if (!opaque) {
+				encode_alpha(&block, dst);
+				dst += 8;
+			}
+
+			encode_color(&block, dst);
+			dst += 8;
+		}
+	}
+
+	free(file->data);
+	file->data = buf;
+	file->size = (uint32_t)newsize;
+	file->format = opaque ? GR_TEXFMT_ARGB_CMP_DXT1 : GR_TEXFMT_ARGB_CMP_DXT5;
+
+	return 0;
+}
@@ -7,13 +7,18 @@
 /**
  * Example usage:
  * zcat MUPEN64PLUS.dat | ./glide64_cache_extract -vv -p MUPEN64PLUS > mupen64plus.tar
+ * ./glide64_cache_extract -j 8 --output-dir tars/ caches/
  */
 
 #include "glide64_cache_extract.h"
+#include <dirent.h>
 #include <errno.h>
 #include <getopt.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 struct _globals globals;
 
@@ -22,9 +27,15 @@ static int convert_input(void)
 	int ret;
 	uint32_t config;
 
+	globals.in_offset = 0;
+
 	ret = get_item(config);
 	if (ret < 0) {
 		fprintf(stderr, "Failed to read config header\n");
+		if (globals.mode == MODE_VERIFY) {
+			verify_truncated(0);
+			return 0;
+		}
 		return ret;
 	}
 
@@ -34,27 +45,435 @@ static int convert_input(void)
 		return ret;
 	}
 
-	while (!feof(globals.in)) {
+	metadata_config(config);
+
+	if (globals.resume) {
+		ret = checkpoint_restore_input();
+		if (ret < 0)
+			return ret;
+	}
+
+	if (globals.mode == MODE_MOUNT)
+		return glide64fs_mount();
+
+	if (globals.sort_keys_count)
+		return convert_sorted();
+
+	while (!input_eof()) {
 		ret = convert_file();
+		if (ret < 0 && globals.mode == MODE_VERIFY) {
+			verify_truncated(globals.in_offset);
+			break;
+		}
+
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+static void add_input_size(FILE *in)
+{
+	struct stat st;
+
+	if (fstat(fileno(in), &st) == 0 && S_ISREG(st.st_mode))
+		progress_add(&progress.total_in, (uint64_t)st.st_size);
+}
+
+static int writes_output(void)
+{
+	/* the diff only extracts the changed records into a given output */
+	if (globals.mode == MODE_DIFF)
+		return globals.out != stdout;
+
+	return globals.mode == MODE_EXTRACT || globals.mode == MODE_SHEET;
+}
+
+static int start_output(void)
+{
+	int ret;
+
+	if (!writes_output())
+		return 0;
+
+	if (globals.resume) {
+		ret = checkpoint_restore_output();
+		if (ret < 0)
+			return ret;
+	}
+
+	return output_open(globals.out);
+}
+
+static int finish_output(void)
+{
+	int ret;
+
+	ret = pipeline_flush();
+	if (ret < 0)
+		return ret;
+
+	if (!writes_output())
+		return 0;
+
+	if (globals.mode == MODE_SHEET) {
+		ret = sheet_flush();
 		if (ret < 0)
 			return ret;
 	}
 
-	ret = write_tarblock(tarblock, sizeof(tarblock), 0);
+	if (globals.archive != ARCHIVE_TAR) {
+		ret = zip_finish();
+		if (ret < 0)
+			return ret;
+	} else {
+		ret = write_tarblock(tarblock, sizeof(tarblock), 0);
+		if (ret < 0) {
+			fprintf(stderr, "Failed to write first EOF tar record\n");
+			return ret;
+		}
+
+		ret = write_tarblock(tarblock, sizeof(tarblock), 0);
+		if (ret < 0) {
+			fprintf(stderr, "Failed to write second EOF tar record\n");
+			return ret;
+		}
+	}
+
+	ret = output_close();
+	if (ret < 0) {
+		fprintf(stderr, "Failed to write output\n");
+		return ret;
+	}
+
+	return 0;
+}
+
+static char *input_prefix(const char *path)
+{
+	const char *name;
+	char *prefix;
+	size_t len;
+
+	name = strrchr(path, '/');
+	if (name)
+		name++;
+	else
+		name = path;
+
+	prefix = strdup(name);
+	if (!prefix)
+		return NULL;
+
+	len = strlen(prefix);
+	if (len > 4 && strcasecmp(&prefix[len - 4], ".dat") == 0)
+		prefix[len - 4] = '\0';
+
+	return prefix;
+}
+
+static char *join_path(const char *dir, const char *name, const char *suffix)
+{
+	size_t len;
+	char *path;
+
+	len = strlen(dir) + 1 + strlen(name) + strlen(suffix) + 1;
+	path = malloc(len);
+	if (!path)
+		return NULL;
+
+	snprintf(path, len, "%s/%s%s", dir, name, suffix);
+
+	return path;
+}
+
+static int convert_path(const char *path)
+{
+	const char *suffix = globals.archive != ARCHIVE_TAR ? ".zip" : ".tar";
+	char *outname = NULL;
+	char *tmpname = NULL;
+	char *prefix;
+	int ret;
+
+	prefix = input_prefix(path);
+	if (!prefix) {
+		fprintf(stderr, "Could not save prefix\n");
+		return -ENOMEM;
+	}
+
+	globals.in = fopen(path, "rb");
+	if (!globals.in) {
+		fprintf(stderr, "Could not open input file %s\n", path);
+		free(prefix);
+		return -ENOENT;
+	}
+
+	/* records still in flight keep a reference to the prefix */
+	globals.prefix = prefix;
+
+	if (globals.output_dir && writes_output()) {
+		/* the output only appears under its final name when complete */
+		outname = join_path(globals.output_dir, prefix, suffix);
+		tmpname = join_path(globals.output_dir, prefix, ".tmp");
+		if (!outname || !tmpname) {
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		globals.out = fopen(tmpname, "wb");
+		if (!globals.out) {
+			fprintf(stderr, "Could not open output file %s\n", tmpname);
+			ret = -ENOENT;
+			goto out;
+		}
+
+		ret = output_open(globals.out);
+		if (ret < 0) {
+			fclose(globals.out);
+			globals.out = NULL;
+			unlink(tmpname);
+			goto out;
+		}
+	}
+
+	if (globals.verbose >= VERBOSITY_GLOBAL_HEADER)
+		fprintf(stderr, "Input: %s\n", path);
+
+	add_input_size(globals.in);
+
+	ret = convert_input();
+
+	/* pending records may still reference the input file and the prefix */
+	if (ret >= 0)
+		ret = pipeline_flush();
+	if (ret < 0)
+		pipeline_discard();
+
+	if (globals.output_dir && writes_output()) {
+		if (ret >= 0)
+			ret = finish_output();
+		else
+			output_close();
+
+		/* the next output must not start with the state of this one */
+		if (ret < 0) {
+			zip_abort();
+			sheet_abort();
+		}
+
+		if (fclose(globals.out) != 0 && ret >= 0) {
+			fprintf(stderr, "Could not write output file %s\n", tmpname);
+			ret = -EIO;
+		}
+		globals.out = NULL;
+
+		if (ret >= 0 && rename(tmpname, outname) < 0) {
+			fprintf(stderr, "Could not rename output file to %s\n", outname);
+			ret = -EIO;
+		}
+
+		if (ret < 0)
+			unlink(tmpname);
+	}
+
+out:
+	free(tmpname);
+	free(outname);
+
+	/* no record references the prefix after the pipeline was drained */
+	globals.prefix = NULL;
+	free(prefix);
+
+	fclose(globals.in);
+	globals.in = NULL;
+
+	return ret;
+}
+
+static int filter_cache(const struct dirent *entry)
+{
+	size_t len = strlen(entry->d_name);
+
+	if (entry->d_name[0] == '.')
+		return 0;
+
+	return len > 4 && strcasecmp(&entry->d_name[len - 4], ".dat") == 0;
+}
+
+static int convert_watched(const char *path)
+{
+	int ret;
+
+	ret = convert_path(path);
+	if (ret < 0)
+		fprintf(stderr, "Failed to convert %s\n", path);
+
+	/* a single broken cache must not stop the watcher */
+	return 0;
+}
+
+static int convert_directory(const char *path, watch_convert_t convert)
+{
+	struct dirent **entries;
+	char *filename;
+	int count;
+	int ret = 0;
+	int i;
+
+	count = scandir(path, &entries, filter_cache, alphasort);
+	if (count < 0) {
+		fprintf(stderr, "Could not read input directory %s\n", path);
+		return -ENOENT;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (ret >= 0) {
+			filename = join_path(path, entries[i]->d_name, "");
+			if (!filename) {
+				ret = -ENOMEM;
+			} else {
+				ret = convert(filename);
+				free(filename);
+			}
+		}
+
+		free(entries[i]);
+	}
+	free(entries);
+
+	return ret;
+}
+
+static int diff_inputs(const char *old, const char *new)
+{
+	int ret;
+
+	if (!globals.prefix) {
+		globals.prefix = input_prefix(new);
+		if (!globals.prefix) {
+			fprintf(stderr, "Could not save prefix\n");
+			return -ENOMEM;
+		}
+	}
+
+	ret = start_output();
+	if (ret < 0)
+		return ret;
+
+	ret = diff_caches(old, new, writes_output());
+	if (ret < 0) {
+		if (writes_output())
+			output_close();
+		return ret;
+	}
+
+	return finish_output();
+}
+
+static int build_inputs(int count, char *paths[])
+{
+	int ret;
+
+	if (!count)
+		add_input_size(globals.in);
+
+	ret = output_open(globals.out);
+	if (ret < 0)
+		return ret;
+
+	ret = build_cache(count, paths);
 	if (ret < 0) {
-		fprintf(stderr, "Failed to write first EOF tar record\n");
+		output_close();
 		return ret;
 	}
 
-	ret = write_tarblock(tarblock, sizeof(tarblock), 0);
+	ret = output_close();
 	if (ret < 0) {
-		fprintf(stderr, "Failed to write second EOF tar record\n");
+		fprintf(stderr, "Failed to write output\n");
 		return ret;
 	}
 
 	return 0;
 }
 
+static int convert_inputs(int argc, char *argv[])
+{
+	struct stat st;
+	int ret;
+	int i;
+
+	if (globals.mode == MODE_DIFF)
+		return diff_inputs(argv[optind], argv[optind + 1]);
+
+	if (globals.mode == MODE_BUILD)
+		return build_inputs(argc - optind, &argv[optind]);
+
+	/* initial conversion of all caches, afterwards only the changed ones */
+	if (globals.watch_dir) {
+		ret = convert_directory(globals.watch_dir, convert_watched);
+		if (ret < 0)
+			return ret;
+
+		return watch_directory(globals.watch_dir, convert_watched);
+	}
+
+	/* single stream given via stdin or --input */
+	if (optind >= argc) {
+		add_input_size(globals.in);
+
+		ret = start_output();
+		if (ret < 0)
+			return ret;
+
+		/* pipes are read by a separate thread to overlap with the decoder */
+		ret = readahead_start(globals.in);
+		if (ret < 0) {
+			output_close();
+			return ret;
+		}
+
+		ret = convert_input();
+		if (ret < 0) {
+			readahead_stop();
+			output_close();
+			return ret;
+		}
+
+		ret = finish_output();
+		readahead_stop();
+
+		return ret;
+	}
+
+	if (!globals.output_dir) {
+		ret = start_output();
+		if (ret < 0)
+			return ret;
+	}
+
+	for (i = optind; i < argc; i++) {
+		if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode))
+			ret = convert_directory(argv[i], convert_path);
+		else
+			ret = convert_path(argv[i]);
+
+		if (ret < 0)
+			break;
+	}
+
+	if (globals.output_dir && writes_output())
+		return ret;
+
+	if (ret < 0) {
+		if (writes_output())
+			output_close();
+		return ret;
+	}
+
+	return finish_output();
+}
+
 static void usage(int argc, char *argv[])
 {
 	const char *cmd = "glide64_cache_extract";
@@ -62,7 +481,7 @@ static void usage(int argc, char *argv[])
 	if (argc > 1)
 		cmd = argv[0];
 
-	printf("Usage: %s [options]\n\n", cmd);
+	printf("Usage: %s [options] [FILE|DIR]...\n\n", cmd);
 	printf("options:\n");
 	printf("\t -i,--input FILE                   Use FILE as uncompressed input file (default: stdin)\n");
 	printf("\t -o,--output FILE                  Use FILE as output file (default: stdout)\n");
@@ -71,13 +490,61 @@ static void usage(int argc, char *argv[])
 	printf("\t -v,--verbose                      Print extra information on stderr (repeat for more verbosity)\n");
 	printf("\t -e,--ignore-error                 Skip current file when an conversion error is detected\n");
 	printf("\t -b,--bitmapv5                     Use V5 Windows Bitmap files with ImageMagick compatible alpha channels\n");
+	printf("\t -u,--untile                       Reassemble tiled hires textures to their original size\n");
+	printf("\t -n,--native                       Write all formats as DDS in their stored pixel layout\n");
+	printf("\t -T,--top-down                     Write Windows Bitmap rows top-down so ARGB_8888 payloads are copied unchanged\n");
+	printf("\t -r,--reduce                       Write opaque textures as 24 bit and textures with up to 256 colors as 8 bit bitmaps\n");
+	printf("\t -D,--store DIR                    Write each distinct texture once to DIR and link it from the tar\n");
+	printf("\t -R,--resume                       Write checkpoints next to --output and continue from the last one\n");
+	printf("\t -c,--compress [fast|hq]           Compress uncompressed textures to DXT1 (opaque) or DXT5 DDS files\n");
+	printf("\t -l,--lut [auto|always|never]      Expand 16 bit formats using lookup tables (default: auto)\n");
+	printf("\t -z,--zip [store|deflate]          Write a zip archive with stored or deflated entries instead of a tar\n");
+	printf("\t -s,--sort KEY[,KEY...]            Sort output of seekable inputs by format, width, height, dimensions,\n");
+	printf("\t                                   checksum, size or offset (default: format,dimensions,checksum)\n");
+	printf("\t -j,--jobs N                       Convert textures using N threads (default: number of CPUs)\n");
+	printf("\t -O,--output-dir DIR               Write one tar per input FILE into DIR instead of a combined output\n");
+	printf("\t -w,--watch DIR                    Convert new and changed *.dat files in DIR to --output-dir until stopped\n");
+	printf("\t -M,--mount DIR                    Mount the input as read-only filesystem at DIR until unmounted\n");
+	printf("\t -C,--cache-size MIB               Memory for converted textures of the mounted filesystem (default: 256)\n");
+	printf("\t -d,--diff OLD NEW                 Report added, removed and changed records of NEW and write them to --output\n");
+	printf("\t -V,--verify                       Only check the integrity of all records and write no output\n");
+	printf("\t -P,--progress                     Show progress and throughput on stderr\n");
+	printf("\t -F,--progress-fd FD               Write machine readable progress lines to file descriptor FD\n");
+	printf("\t -m,--metadata FILE                Write the headers of all records as JSON lines to FILE\n");
+	printf("\t -x,--trace FILE                   Write per-record timings as Chrome trace-event JSON to FILE\n");
+	printf("\t -S,--contact-sheet SIZE           Write thumbnails of at most SIZE pixels on contact sheets instead of single textures\n");
+	printf("\t -B,--build CONFIG                 Build a cache with the config word CONFIG from images in DIRs or tars\n");
+	printf("\t -f,--format NAME                  Store bitmaps as GR_TEXFMT_NAME in the built cache (default: ARGB_8888)\n");
+	printf("\t -a,--analyze                      Print statistics about the input instead of extracting it\n");
 	printf("\t -h,--help                         Show this message and exit\n");
+	printf("\n");
+	printf("Each FILE (or *.dat file in DIR) is used as uncompressed input file and its\n");
+	printf("name without .dat extension is used as prefix for the extracted files\n");
+}
+
+static unsigned int default_jobs(void)
+{
+	long cpus;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 1)
+		return 1;
+
+	return (unsigned int)cpus;
 }
 
 static int init(int argc, char *argv[])
 {
 	int o;
 	int options_index;
+	char *end;
+	long jobs;
+	long fd;
+	long cache_size;
+	long sheet_tile;
+	unsigned long config;
+	const char *output = NULL;
+	const char *metadata = NULL;
 
 	static const struct option long_options[] = {
 		{"verbose",		no_argument,		NULL, 'v'},
@@ -88,6 +555,31 @@ static int init(int argc, char *argv[])
 		{"bitmapv5",		no_argument,		NULL, 'b'},
 		{"input",		required_argument,	NULL, 'i'},
 		{"output",		required_argument,	NULL, 'o'},
+		{"untile",		no_argument,		NULL, 'u'},
+		{"native",		no_argument,		NULL, 'n'},
+		{"top-down",		no_argument,		NULL, 'T'},
+		{"store",		required_argument,	NULL, 'D'},
+		{"resume",		no_argument,		NULL, 'R'},
+		{"reduce",		no_argument,		NULL, 'r'},
+		{"compress",		required_argument,	NULL, 'c'},
+		{"lut",			required_argument,	NULL, 'l'},
+		{"zip",			required_argument,	NULL, 'z'},
+		{"sort",		required_argument,	NULL, 's'},
+		{"jobs",		required_argument,	NULL, 'j'},
+		{"output-dir",		required_argument,	NULL, 'O'},
+		{"watch",		required_argument,	NULL, 'w'},
+		{"mount",		required_argument,	NULL, 'M'},
+		{"cache-size",		required_argument,	NULL, 'C'},
+		{"diff",		no_argument,		NULL, 'd'},
+		{"verify",		no_argument,		NULL, 'V'},
+		{"progress",		no_argument,		NULL, 'P'},
+		{"trace",		required_argument,	NULL, 'x'},
+		{"progress-fd",		required_argument,	NULL, 'F'},
+		{"metadata",		required_argument,	NULL, 'm'},
+		{"analyze",		no_argument,		NULL, 'a'},
+		{"contact-sheet",	required_argument,	NULL, 'S'},
+		{"build",		required_argument,	NULL, 'B'},
+		{"format",		required_argument,	NULL, 'f'},
 		{NULL,			0,			NULL,  0 },
 	};
 
@@ -96,8 +588,11 @@ static int init(int argc, char *argv[])
 
 	globals.in = stdin;
 	globals.out = stdout;
+	globals.jobs = default_jobs();
+	globals.progress_fd = -1;
+	globals.mount_cache_size = 256 * 1024 * 1024;
 
-	while ((o = getopt_long(argc, argv, "vp:t:ebhi:o:", long_options, &options_index)) != -1) {
+	while ((o = getopt_long(argc, argv, "vp:t:ebunTD:Rrhi:o:c:l:z:s:j:O:w:M:C:dVPx:F:m:aS:B:f:", long_options, &options_index)) != -1) {
 		switch (o) {
 		case 'v':
 			globals.verbose++;
@@ -129,6 +624,141 @@ static int init(int argc, char *argv[])
 		case 'b':
 			globals.bitmapv5 = 1;
 			break;
+		case 'u':
+			globals.untile = 1;
+			break;
+		case 'n':
+			globals.native = 1;
+			break;
+		case 'T':
+			globals.top_down = 1;
+			break;
+		case 'D':
+			globals.store_dir = optarg;
+			break;
+		case 'R':
+			globals.resume = 1;
+			break;
+		case 'r':
+			globals.reduce = 1;
+			break;
+		case 'c':
+			if (strcasecmp(optarg, "fast") == 0) {
+				globals.encode = ENCODE_FAST;
+			} else if (strcasecmp(optarg, "hq") == 0) {
+				globals.encode = ENCODE_HQ;
+			} else {
+				fprintf(stderr, "Invalid compression mode %s\n", optarg);
+				return -EINVAL;
+			}
+			break;
+		case 'l':
+			if (strcasecmp(optarg, "auto") == 0) {
+				globals.lut = LUT_AUTO;
+			} else if (strcasecmp(optarg, "always") == 0) {
+				globals.lut = LUT_ALWAYS;
+			} else if (strcasecmp(optarg, "never") == 0) {
+				globals.lut = LUT_NEVER;
+			} else {
+				fprintf(stderr, "Invalid lookup table mode %s\n", optarg);
+				return -EINVAL;
+			}
+			break;
+		case 'z':
+			if (strcasecmp(optarg, "store") == 0) {
+				globals.archive = ARCHIVE_ZIP_STORE;
+			} else if (strcasecmp(optarg, "deflate") == 0) {
+				globals.archive = ARCHIVE_ZIP_DEFLATE;
+			} else {
+				fprintf(stderr, "Invalid zip method %s\n", optarg);
+				return -EINVAL;
+			}
+			break;
+		case 's':
+			if (parse_sort_keys(optarg) < 0)
+				return -EINVAL;
+			break;
+		case 'j':
+			jobs = strtol(optarg, &end, 10);
+			if (!*optarg || *end || jobs < 1 || jobs > 1024) {
+				fprintf(stderr, "Invalid number of jobs %s\n", optarg);
+				return -EINVAL;
+			}
+			globals.jobs = (unsigned int)jobs;
+			break;
+		case 'O':
+			globals.output_dir = optarg;
+			break;
+		case 'w':
+			globals.watch_dir = optarg;
+			break;
+		case 'M':
+			globals.mode = MODE_MOUNT;
+			globals.mount_point = optarg;
+			break;
+		case 'C':
+			cache_size = strtol(optarg, &end, 10);
+			if (!*optarg || *end || cache_size < 1 || cache_size > 1024 * 1024) {
+				fprintf(stderr, "Invalid cache size %s\n", optarg);
+				return -EINVAL;
+			}
+			globals.mount_cache_size = (size_t)cache_size * 1024 * 1024;
+			break;
+		case 'd':
+			globals.mode = MODE_DIFF;
+			break;
+		case 'V':
+			globals.mode = MODE_VERIFY;
+			break;
+		case 'a':
+			globals.mode = MODE_ANALYZE;
+			break;
+		case 'S':
+			sheet_tile = strtol(optarg, &end, 10);
+			if (!*optarg || *end || sheet_tile < 1 || sheet_tile > 256) {
+				fprintf(stderr, "Invalid contact sheet tile size %s\n", optarg);
+				return -EINVAL;
+			}
+			globals.mode = MODE_SHEET;
+			globals.sheet_tile = (uint32_t)sheet_tile;
+			break;
+		case 'B':
+			errno = 0;
+			config = strtoul(optarg, &end, 0);
+			if (!*optarg || *end || errno || config > UINT32_MAX) {
+				fprintf(stderr, "Invalid config word %s\n", optarg);
+				return -EINVAL;
+			}
+			globals.mode = MODE_BUILD;
+			globals.build_config = (uint32_t)config;
+			break;
+		case 'f':
+			globals.build_format = texture_format_find(optarg);
+			if (!globals.build_format ||
+			    (!globals.build_format->pack &&
+			     texture_format_id(globals.build_format) != GR_TEXFMT_ARGB_8888)) {
+				fprintf(stderr, "Unsupported texture format %s\n", optarg);
+				return -EINVAL;
+			}
+			break;
+		case 'P':
+			globals.progress = 1;
+			break;
+		case 'm':
+			metadata = optarg;
+			break;
+		case 'x':
+			if (trace_open(optarg) < 0)
+				return -ENOENT;
+			break;
+		case 'F':
+			fd = strtol(optarg, &end, 10);
+			if (!*optarg || *end || fd < 0 || fd > INT_MAX) {
+				fprintf(stderr, "Invalid progress file descriptor %s\n", optarg);
+				return -EINVAL;
+			}
+			globals.progress_fd = (int)fd;
+			break;
 		case 'i':
 			if (globals.in != stdin)
 				fclose(globals.in);
@@ -140,14 +770,7 @@ static int init(int argc, char *argv[])
 			}
 			break;
 		case 'o':
-			if (globals.out != stdout)
-				fclose(globals.out);
-
-			globals.out = fopen(optarg, "wb");
-			if (!globals.out) {
-				fprintf(stderr, "Could not open output file %s\n", optarg);
-				return -ENOENT;
-			}
+			output = optarg;
 			break;
 		default:
 			usage(argc, argv);
@@ -155,6 +778,93 @@ static int init(int argc, char *argv[])
 		}
 	}
 
+	if (globals.watch_dir && (!globals.output_dir || globals.mode != MODE_EXTRACT)) {
+		fprintf(stderr, "--watch requires --output-dir\n");
+		return -EINVAL;
+	}
+
+	if (globals.mode == MODE_DIFF && optind + 2 != argc) {
+		fprintf(stderr, "--diff requires two input files\n");
+		return -EINVAL;
+	}
+
+	if (globals.mode == MODE_MOUNT && optind + 1 < argc) {
+		fprintf(stderr, "--mount requires a single input file\n");
+		return -EINVAL;
+	}
+
+	if (globals.mode == MODE_MOUNT && (globals.archive != ARCHIVE_TAR || globals.store_dir)) {
+		fprintf(stderr, "--mount cannot be combined with --zip or --store\n");
+		return -EINVAL;
+	}
+
+	if (globals.watch_dir && optind < argc) {
+		fprintf(stderr, "--watch cannot be combined with input files\n");
+		return -EINVAL;
+	}
+
+	/* input files and watched caches are named after their file */
+	if ((optind < argc || globals.watch_dir) && globals.in != stdin) {
+		fprintf(stderr, "--input cannot be combined with input files or --watch\n");
+		return -EINVAL;
+	}
+
+	if ((optind < argc || globals.watch_dir) && globals.prefix &&
+	    globals.mode != MODE_DIFF && globals.mode != MODE_BUILD) {
+		fprintf(stderr, "--prefix cannot be combined with input files or --watch\n");
+		return -EINVAL;
+	}
+
+	if (globals.resume &&
+	    (!output || globals.mode != MODE_EXTRACT || globals.output_dir ||
+	     globals.archive != ARCHIVE_TAR || globals.sort_keys_count || optind < argc)) {
+		fprintf(stderr, "--resume requires a single --input and a tar --output\n");
+		return -EINVAL;
+	}
+
+	if (globals.build_format && globals.mode != MODE_BUILD) {
+		fprintf(stderr, "--format requires --build\n");
+		return -EINVAL;
+	}
+
+	if (globals.mode == MODE_BUILD && globals.output_dir) {
+		fprintf(stderr, "--build writes a single cache to --output\n");
+		return -EINVAL;
+	}
+
+	if (!globals.build_format)
+		globals.build_format = texture_format_get(GR_TEXFMT_ARGB_8888);
+
+	if (globals.store_dir &&
+	    ((globals.mode != MODE_EXTRACT && globals.mode != MODE_DIFF) ||
+	     globals.archive != ARCHIVE_TAR)) {
+		fprintf(stderr, "--store requires extraction to a tar\n");
+		return -EINVAL;
+	}
+
+	if (globals.store_dir && store_open(globals.store_dir) < 0)
+		return -EINVAL;
+
+	if (output) {
+		/* the content in front of the checkpoint must be kept */
+		globals.out = NULL;
+		if (globals.resume)
+			globals.out = fopen(output, "r+b");
+		if (!globals.out)
+			globals.out = fopen(output, "wb");
+		if (!globals.out) {
+			fprintf(stderr, "Could not open output file %s\n", output);
+			return -ENOENT;
+		}
+	}
+
+	if (globals.resume && checkpoint_open(output) < 0)
+		return -EINVAL;
+
+	/* a resumed run keeps the records of the interrupted one */
+	if (metadata && metadata_open(metadata, checkpoint_metadata_offset()) < 0)
+		return -ENOENT;
+
 	return 0;
 }
 
@@ -168,9 +878,54 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
-	ret = convert_input();
+	switch (globals.mode) {
+	case MODE_VERIFY:
+		ret = pipeline_init(globals.jobs, verify_file, verify_finish);
+		break;
+	case MODE_ANALYZE:
+		ret = pipeline_init(1, analyze_file, analyze_finish);
+		break;
+	case MODE_SHEET:
+		ret = pipeline_init(globals.jobs, sheet_file, sheet_finish);
+		break;
+	case MODE_BUILD:
+		ret = pipeline_init(globals.jobs, build_file, build_finish);
+		break;
+	case MODE_EXTRACT:
+	default:
+		ret = pipeline_init(globals.jobs, prepare_file, export_file);
+		break;
+	}
+	if (ret < 0)
+		return 2;
+
+	ret = progress_start();
+	if (ret < 0) {
+		pipeline_exit();
+		return 2;
+	}
+
+	ret = convert_inputs(argc, argv);
+	pipeline_exit();
+	checkpoint_close(ret >= 0);
+	if (store_close() < 0 && ret >= 0)
+		ret = -EIO;
+	progress_stop();
+	if (metadata_close() < 0 && ret >= 0)
+		ret = -EIO;
+	if (trace_close() < 0 && ret >= 0)
+		ret = -EIO;
 	if (ret < 0)
 		return 2;
 
+	if (globals.mode == MODE_VERIFY && verify_summary() < 0)
+		return 3;
+
+	if (globals.mode == MODE_DIFF && diff_summary() < 0)
+		return 3;
+
+	if (globals.mode == MODE_ANALYZE && analyze_report() < 0)
+		return 2;
+
 	return 0;
 }
@@ -20,6 +20,7 @@
 #define le16toh
 #define htole32
 #define le32toh
+#define htole64
 #define le64toh
 
 #else /* __ORDER_LITTLE_ENDIAN__ */
@@ -87,6 +88,21 @@ static inline uint32_t le32toh(uint32_t little_endian_32bits)
 	return output;
 }
 
+static inline uint64_t htole64(uint64_t host_64bits)
+{
+	static const uint64_t order = 0x0001020304050607ULL;
+	static const uint8_t *pos = (uint8_t *)&order;
+	uint8_t *in = (uint8_t *)&host_64bits;
+	uint64_t output;
+	uint8_t *out = (uint8_t *)&output;
+	size_t i;
+
+	for (i = 0; i < sizeof(output); i++)
+		out[sizeof(output) - 1 - i] = in[pos[i]];
+
+	return output;
+}
+
 static inline uint64_t le64toh(uint64_t little_endian_64bits)
 {
 	static const uint64_t order = 0x0001020304050607ULL;
@@ -174,8 +190,12 @@ static inline uint64_t le64toh(uint64_t little_endian_64bits)
 #define GR_TEXFMT_ARGB_CMP_DXT5      0x1AU
 #define GR_TEXFMT_GZ                 0x8000U
 
+#define STORE_NAME_LEN 40
+
 struct glide64_file {
 	void *data;
+	const char *prefix;
+	const char *name;
 	uint64_t checksum;
 	uint32_t width;
 	uint32_t height;
@@ -188,6 +208,59 @@ struct glide64_file {
 	uint32_t size;
 	uint16_t format;
 	uint8_t is_hires_tex;
+	uint32_t cache_width;
+	uint32_t cache_height;
+	uint16_t cache_format;
+	uint32_t cache_size;
+	uint32_t cache_crc;
+	uint64_t offset;
+	uint64_t record_size;
+	int payload_fd;
+	uint64_t payload_offset;
+	uint32_t payload_size;
+	uint32_t crc;
+	uint32_t zip_size;
+	uint16_t zip_method;
+	uint8_t store_hit;
+	uint32_t store_crc;
+	char store_name[STORE_NAME_LEN];
+};
+
+struct expand_lut;
+
+#define PALETTE_HASH_SIZE 512
+
+struct color_palette {
+	uint32_t colors[256];
+	unsigned int count;
+	uint32_t keys[PALETTE_HASH_SIZE];
+	uint8_t index[PALETTE_HASH_SIZE];
+	uint8_t used[PALETTE_HASH_SIZE];
+};
+
+enum texture_container {
+	CONTAINER_NONE = 0,
+	CONTAINER_BMP,
+	CONTAINER_DDS,
+};
+
+struct texture_format {
+	const char *name;
+	uint8_t bits_per_pixel;
+	uint8_t block_width;
+	uint8_t block_height;
+	enum texture_container container;
+	void (*expand)(uint32_t *dst, const void *src, size_t pixels);
+	void (*pack)(void *dst, const uint32_t *src, size_t pixels);
+	struct expand_lut *lut;
+	uint32_t dds_flags;
+	uint32_t dds_pf_flags;
+	uint32_t dds_fourcc;
+	uint32_t dds_bitcount;
+	uint32_t dds_rmask;
+	uint32_t dds_gmask;
+	uint32_t dds_bmask;
+	uint32_t dds_amask;
 };
 
 enum verbosity_level {
@@ -201,19 +274,120 @@ enum input_type {
 	INPUT_TEX,
 };
 
+enum run_mode {
+	MODE_EXTRACT = 0,
+	MODE_VERIFY,
+	MODE_ANALYZE,
+	MODE_MOUNT,
+	MODE_DIFF,
+	MODE_SHEET,
+	MODE_BUILD,
+};
+
+enum lut_mode {
+	LUT_AUTO = 0,
+	LUT_ALWAYS,
+	LUT_NEVER,
+};
+
+enum encode_mode {
+	ENCODE_NONE = 0,
+	ENCODE_FAST,
+	ENCODE_HQ,
+};
+
+enum archive_format {
+	ARCHIVE_TAR = 0,
+	ARCHIVE_ZIP_STORE,
+	ARCHIVE_ZIP_DEFLATE,
+};
+
+enum sort_key {
+	SORT_FORMAT,
+	SORT_WIDTH,
+	SORT_HEIGHT,
+	SORT_CHECKSUM,
+	SORT_SIZE,
+	SORT_OFFSET,
+};
+
+#define MAX_SORT_KEYS 8
+
 extern uint8_t tarblock[512];
 
 struct _globals {
+	enum run_mode mode;
 	int verbose;
 	enum input_type type;
 	int ignore_error;
 	int bitmapv5;
+	int untile;
+	int native;
+	int top_down;
+	int reduce;
+	int resume;
+	enum encode_mode encode;
+	enum lut_mode lut;
+	unsigned int jobs;
+	enum archive_format archive;
+	enum sort_key sort_keys[MAX_SORT_KEYS];
+	unsigned int sort_keys_count;
 	char *prefix;
+	const char *output_dir;
+	const char *watch_dir;
+	const char *mount_point;
+	const char *store_dir;
+	size_t mount_cache_size;
+	uint32_t sheet_tile;
+	uint32_t build_config;
+	const struct texture_format *build_format;
 	FILE *in;
+	uint64_t in_offset;
 	FILE *out;
+	int progress;
+	int progress_fd;
 };
 extern struct _globals globals;
 
+struct progress_counters {
+	uint64_t records;
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	uint64_t total_in;
+};
+extern struct progress_counters progress;
+
+static inline void progress_add(uint64_t *counter, uint64_t value)
+{
+	__atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+static inline void progress_sub(uint64_t *counter, uint64_t value)
+{
+	__atomic_fetch_sub(counter, value, __ATOMIC_RELAXED);
+}
+
+extern int trace_enabled;
+
+uint64_t trace_clock(void);
+void trace_record(const struct glide64_file *file, const char *name,
+		  uint64_t start);
+
+static inline uint64_t trace_begin(void)
+{
+	if (!trace_enabled)
+		return 0;
+
+	return trace_clock();
+}
+
+static inline void trace_end(const struct glide64_file *file, const char *name,
+			     uint64_t start)
+{
+	if (trace_enabled)
+		trace_record(file, name, start);
+}
+
 struct tar_header {
 	char name[100];
 	char mode[8];
@@ -228,11 +402,119 @@ struct tar_header {
 
 int parse_config(uint32_t config);
 
+const struct texture_format *texture_format_get(uint16_t format);
+const struct texture_format *texture_format_find(const char *name);
+uint16_t texture_format_id(const struct texture_format *fmt);
+enum texture_container texture_container_get(const struct texture_format *fmt);
+
+typedef int (*pipeline_process_t)(struct glide64_file *file);
+typedef int (*pipeline_finish_t)(struct glide64_file *file, int status);
+
+int pipeline_init(unsigned int jobs, pipeline_process_t process,
+		  pipeline_finish_t finish);
+int pipeline_submit(struct glide64_file *file);
+int pipeline_flush(void);
+void pipeline_discard(void);
+void pipeline_exit(void);
+
+int glide64fs_mount(void);
+
+int sheet_file(struct glide64_file *file);
+int sheet_finish(struct glide64_file *file, int status);
+int sheet_flush(void);
+void sheet_abort(void);
+
+int build_file(struct glide64_file *file);
+int build_finish(struct glide64_file *file, int status);
+int build_cache(int count, char *paths[]);
+
+int diff_caches(const char *path_a, const char *path_b, int extract);
+int diff_summary(void);
+
+typedef int (*watch_convert_t)(const char *path);
+
+int watch_directory(const char *path, watch_convert_t convert);
+
+int checkpoint_open(const char *output);
+int64_t checkpoint_metadata_offset(void);
+int checkpoint_restore_output(void);
+int checkpoint_restore_input(void);
+int checkpoint_update(const struct glide64_file *file);
+void checkpoint_close(int success);
+
+int store_open(const char *dir);
+void store_lookup(struct glide64_file *file);
+int store_check(struct glide64_file *file);
+int store_hash(struct glide64_file *file);
+int store_write_file(struct glide64_file *file);
+int store_close(void);
+
+int parse_sort_keys(const char *keys);
+int convert_sorted(void);
+
+int readahead_start(FILE *in);
+int readahead_active(void);
+size_t readahead_read(void *buffer, size_t size);
+int readahead_eof(void);
+int readahead_error(void);
+void readahead_stop(void);
+
+int input_eof(void);
+int input_error(void);
+int read_file_header(struct glide64_file *file);
 int convert_file(void);
+int export_file(struct glide64_file *file, int status);
 int get_buffer_endian(void *buffer, size_t size, int print_error);
 #define get_item(x) get_buffer_endian(&x, sizeof(x), 1)
+size_t image_content_length(const struct glide64_file *file);
+size_t output_content_length(const struct glide64_file *file);
+int output_length_exact(const struct glide64_file *file);
+int file_passthrough(const struct glide64_file *file);
 int prepare_file(struct glide64_file *file);
+int normalize_file(struct glide64_file *file);
+int wrap_bitmap(struct glide64_file *file);
+int encode_image(struct glide64_file *file);
+int decode_image(struct glide64_file *file);
+int pack_file(struct glide64_file *file, const struct texture_format *fmt);
+int image_opaque(const void *pixels, size_t count);
+int image_palette(const void *pixels, size_t count, struct color_palette *palette);
+uint8_t palette_index(const struct color_palette *palette, uint32_t color);
+int analyze_file(struct glide64_file *file);
+int analyze_finish(struct glide64_file *file, int status);
+int analyze_report(void);
+
+int verify_file(struct glide64_file *file);
+int verify_finish(struct glide64_file *file, int status);
+void verify_truncated(uint64_t offset);
+int verify_summary(void);
+
+int metadata_open(const char *path, int64_t offset);
+int metadata_close(void);
+int metadata_sync(uint64_t *offset);
+void metadata_config(uint32_t config);
+void metadata_file(const struct glide64_file *file, const char *name,
+		   const char *status);
+
+int trace_open(const char *path);
+int trace_close(void);
+
+int progress_start(void);
+void progress_stop(void);
+
+int output_open(FILE *out);
+int output_write(const void *buffer, size_t size);
+int output_can_splice(void);
+int output_splice(int fd, uint64_t offset, size_t size);
+uint64_t output_tell(void);
+int output_sync(void);
+int output_close(void);
 int write_tarblock(void *buffer, size_t size, size_t offset);
+void file_name(const struct glide64_file *file, char *name, size_t size);
+int write_tar_link(const char *name, const char *target);
 int write_file(struct glide64_file *file);
+int zip_prepare(struct glide64_file *file);
+int zip_write_file(struct glide64_file *file);
+int zip_finish(void);
+void zip_abort(void);
 
 #endif
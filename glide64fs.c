@@ -0,0 +1,432 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* glide64_cache_extract, Glide64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+#include "glide64_cache_extract.h"
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_FUSE
+
+#define FUSE_USE_VERSION 31
+
+#include <fcntl.h>
+#include <fuse.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/* Only the record headers are read when the filesystem is mounted. The
+ * content of a texture is read and converted when the file is opened and
+ * kept in a LRU cache until the memory budget is exceeded. Files which are
+ * still open are never evicted.
+ */
+
+struct fs_entry {
+	char name[100];
+	struct glide64_file header;
+	off_t payload_pos;
+	size_t size;
+	int size_exact;
+
+	void *data;
+	unsigned int users;
+	struct fs_entry *lru_prev;
+	struct fs_entry *lru_next;
+};
+
+static struct {
+	struct fs_entry *entries;
+	size_t count;
+	size_t alloc;
+	int fd;
+	time_t mtime;
+
+	pthread_mutex_t lock;
+	struct fs_entry *lru_head;
+	struct fs_entry *lru_tail;
+	size_t cached;
+} fs = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static int compare_name(const void *a, const void *b)
+{
+	const struct fs_entry *entry_a = a;
+	const struct fs_entry *entry_b = b;
+
+	return strcmp(entry_a->name, entry_b->name);
+}
+
+/* qsort is not stable, the position in the cache decides between records
+ * with the same name
+ */
+static int compare_entry(const void *a, const void *b)
+{
+	const struct fs_entry *entry_a = a;
+	const struct fs_entry *entry_b = b;
+	int ret;
+
+	ret = compare_name(a, b);
+	if (ret != 0)
+		return ret;
+
+	if (entry_a->payload_pos < entry_b->payload_pos)
+		return -1;
+	if (entry_a->payload_pos > entry_b->payload_pos)
+		return 1;
+
+	return 0;
+}
+
+static struct fs_entry *fs_lookup(const char *path)
+{
+	struct fs_entry key;
+
+	if (path[0] != '/')
+		return NULL;
+
+	snprintf(key.name, sizeof(key.name), "%s", path + 1);
+
+	return bsearch(&key, fs.entries, fs.count, sizeof(*fs.entries), compare_name);
+}
+
+static void lru_unlink(struct fs_entry *entry)
+{
+	if (entry->lru_prev)
+		entry->lru_prev->lru_next = entry->lru_next;
+	else
+		fs.lru_head = entry->lru_next;
+
+	if (entry->lru_next)
+		entry->lru_next->lru_prev = entry->lru_prev;
+	else
+		fs.lru_tail = entry->lru_prev;
+
+	entry->lru_prev = NULL;
+	entry->lru_next = NULL;
+}
+
+static void lru_push(struct fs_entry *entry)
+{
+	entry->lru_prev = NULL;
+	entry->lru_next = fs.lru_head;
+	if (fs.lru_head)
+		fs.lru_head->lru_prev = entry;
+	else
+		fs.lru_tail = entry;
+	fs.lru_head = entry;
+}
+
+static void lru_evict(void)
+{
+	struct fs_entry *entry, *prev;
+
+	for (entry = fs.lru_tail; entry && fs.cached > globals.mount_cache_size; entry = prev) {
+		prev = entry->lru_prev;
+		if (entry->users)
+			continue;
+
+		lru_unlink(entry);
+		fs.cached -= entry->size;
+		free(entry->data);
+		entry->data = NULL;
+	}
+}
+
+static int fs_decode(const struct fs_entry *entry, struct glide64_file *file)
+{
+	ssize_t len;
+	int ret;
+
+	*file = entry->header;
+	file->data = malloc(file->size);
+	if (!file->data)
+		return -ENOMEM;
+
+	len = pread(fs.fd, file->data, file->size, entry->payload_pos);
+	if (len < 0 || (size_t)len != file->size) {
+		free(file->data);
+		return -EIO;
+	}
+
+	ret = prepare_file(file);
+	if (ret < 0) {
+		free(file->data);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static int fs_getattr(const char *path, struct stat *st,
+		      struct fuse_file_info *fi __attribute__((unused)))
+{
+	struct fs_entry *entry;
+
+	memset(st, 0, sizeof(*st));
+	st->st_mtime = fs.mtime;
+
+	if (strcmp(path, "/") == 0) {
+		st->st_mode = S_IFDIR | 0555;
+		st->st_nlink = 2;
+		return 0;
+	}
+
+	entry = fs_lookup(path);
+	if (!entry)
+		return -ENOENT;
+
+	st->st_mode = S_IFREG | 0444;
+	st->st_nlink = 1;
+
+	pthread_mutex_lock(&fs.lock);
+	st->st_size = entry->size;
+	pthread_mutex_unlock(&fs.lock);
+
+	return 0;
+}
+
+static int fs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+		      off_t offset __attribute__((unused)),
+		      struct fuse_file_info *fi __attribute__((unused)),
+		      enum fuse_readdir_flags flags __attribute__((unused)))
+{
+	size_t i;
+
+	if (strcmp(path, "/") != 0)
+		return -ENOENT;
+
+	filler(buf, ".", NULL, 0, 0);
+	filler(buf, "..", NULL, 0, 0);
+
+	for (i = 0; i < fs.count; i++) {
+		if (filler(buf, fs.entries[i].name, NULL, 0, 0))
+			break;
+	}
+
+	return 0;
+}
+
+static int fs_open(const char *path, struct fuse_file_info *fi)
+{
+	struct glide64_file file;
+	struct fs_entry *entry;
+	int ret;
+
+	if ((fi->flags & O_ACCMODE) != O_RDONLY)
+		return -EACCES;
+
+	entry = fs_lookup(path);
+	if (!entry)
+		return -ENOENT;
+
+	/* the size of compressed output is only known after the conversion */
+	if (!entry->size_exact)
+		fi->direct_io = 1;
+	else
+		fi->keep_cache = 1;
+
+	pthread_mutex_lock(&fs.lock);
+	if (entry->data) {
+		lru_unlink(entry);
+		lru_push(entry);
+		goto opened;
+	}
+	pthread_mutex_unlock(&fs.lock);
+
+	/* the conversion runs unlocked, concurrent opens of the same file
+	 * only keep the first result
+	 */
+	ret = fs_decode(entry, &file);
+	if (ret < 0)
+		return ret;
+
+	pthread_mutex_lock(&fs.lock);
+	if (entry->data) {
+		free(file.data);
+		lru_unlink(entry);
+	} else {
+		entry->data = file.data;
+		entry->size = file.size;
+		entry->size_exact = 1;
+		fs.cached += entry->size;
+	}
+	lru_push(entry);
+
+opened:
+	entry->users++;
+	lru_evict();
+	pthread_mutex_unlock(&fs.lock);
+
+	fi->fh = (uint64_t)(uintptr_t)entry;
+
+	return 0;
+}
+
+static int fs_read(const char *path __attribute__((unused)), char *buf,
+		   size_t size, off_t offset, struct fuse_file_info *fi)
+{
+	struct fs_entry *entry = (struct fs_entry *)(uintptr_t)fi->fh;
+
+	/* the data of open files is never evicted */
+	if ((size_t)offset >= entry->size)
+		return 0;
+
+	if (size > entry->size - offset)
+		size = entry->size - offset;
+
+	memcpy(buf, (uint8_t *)entry->data + offset, size);
+
+	return size;
+}
+
+static int fs_release(const char *path __attribute__((unused)),
+		      struct fuse_file_info *fi)
+{
+	struct fs_entry *entry = (struct fs_entry *)(uintptr_t)fi->fh;
+
+	pthread_mutex_lock(&fs.lock);
+	entry->users--;
+	lru_evict();
+	pthread_mutex_unlock(&fs.lock);
+
+	return 0;
+}
+
+static const struct fuse_operations fs_operations = {
+	.getattr = fs_getattr,
+	.readdir = fs_readdir,
+	.open = fs_open,
+	.read = fs_read,
+	.release = fs_release,
+};
+
+static int fs_add_entry(struct glide64_file *file, off_t payload_pos)
+{
+	struct fs_entry *entry, *tmp;
+	struct glide64_file named;
+
+	if (fs.count == fs.alloc) {
+		fs.alloc = fs.alloc ? fs.alloc * 2 : 1024;
+		tmp = realloc(fs.entries, fs.alloc * sizeof(*fs.entries));
+		if (!tmp) {
+			fprintf(stderr, "Could not allocate memory for file list\n");
+			return -ENOMEM;
+		}
+		fs.entries = tmp;
+	}
+
+	entry = &fs.entries[fs.count];
+	memset(entry, 0, sizeof(*entry));
+	entry->header = *file;
+	entry->payload_pos = payload_pos;
+
+	/* name and size are the ones of the converted file */
+	named = *file;
+	named.format &= ~GR_TEXFMT_GZ;
+	file_name(&named, entry->name, sizeof(entry->name));
+	entry->size = output_content_length(file);
+	entry->size_exact = output_length_exact(file);
+
+	fs.count++;
+
+	return 0;
+}
+
+static int fs_read_index(void)
+{
+	struct glide64_file file;
+	struct stat st;
+	off_t pos;
+	size_t i, j;
+	int ret;
+
+	if (fstat(fileno(globals.in), &st) < 0 || !S_ISREG(st.st_mode)) {
+		fprintf(stderr, "Mounting requires a seekable input file\n");
+		return -EINVAL;
+	}
+	fs.mtime = st.st_mtime;
+
+	while (1) {
+		ret = read_file_header(&file);
+		if (ret > 0)
+			break;
+		if (ret < 0)
+			return ret;
+
+		pos = ftello(globals.in);
+		if (pos < 0)
+			return -EIO;
+
+		if (output_content_length(&file) > 0) {
+			ret = fs_add_entry(&file, pos);
+			if (ret < 0)
+				return ret;
+		}
+
+		if (fseeko(globals.in, file.size, SEEK_CUR) < 0)
+			return -EIO;
+		globals.in_offset += file.size;
+	}
+
+	qsort(fs.entries, fs.count, sizeof(*fs.entries), compare_entry);
+
+	/* the first record wins when a texture was stored twice */
+	for (i = 0, j = 0; i < fs.count; i++) {
+		if (j > 0 && strcmp(fs.entries[j - 1].name, fs.entries[i].name) == 0)
+			continue;
+
+		fs.entries[j++] = fs.entries[i];
+	}
+	fs.count = j;
+
+	return 0;
+}
+
+int glide64fs_mount(void)
+{
+	char *argv[] = { "glide64fs", "-f", "-o", "ro", (char *)globals.mount_point, NULL };
+	size_t i;
+	int ret;
+
+	ret = fs_read_index();
+	if (ret < 0)
+		goto out;
+
+	fs.fd = fileno(globals.in);
+
+	if (globals.verbose >= VERBOSITY_GLOBAL_HEADER)
+		fprintf(stderr, "Mounting %zu textures at %s\n", fs.count, globals.mount_point);
+
+	ret = fuse_main(sizeof(argv) / sizeof(argv[0]) - 1, argv, &fs_operations, NULL);
+	if (ret != 0)
+		ret = -EIO;
+
+out:
+	for (i = 0; i < fs.count; i++)
+		free(fs.entries[i].data);
+	free(fs.entries);
+	fs.entries = NULL;
+	fs.count = 0;
+	fs.alloc = 0;
+
+	return ret;
+}
+
+#else
+
+int glide64fs_mount(void)
+{
+	fprintf(stderr, "Mounting is not supported, rebuild with libfuse3\n");
+	return -EOPNOTSUPP;
+}
+
+#endif
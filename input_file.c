@@ -11,25 +11,48 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 
 static int get_buffer(void *buffer, size_t size, int print_error)
 {
 	size_t ret;
 
-	ret = fread(buffer, 1, size, globals.in);
+	if (readahead_active())
+		ret = readahead_read(buffer, size);
+	else
+		ret = fread(buffer, 1, size, globals.in);
+	globals.in_offset += ret;
+	progress_add(&progress.bytes_in, ret);
 
 	if (ret == size)
 		return 0;
 
-	if (ferror(globals.in) && print_error)
+	if (input_error() && print_error)
 		fprintf(stderr, "Error while reading input\n");
 
-	if (feof(globals.in) && print_error)
+	if (input_eof() && print_error)
 		fprintf(stderr, "File stream ended to early\n");
 
 	return -EIO;
 }
 
+int input_eof(void)
+{
+	if (readahead_active())
+		return readahead_eof();
+
+	return feof(globals.in);
+}
+
+int input_error(void)
+{
+	if (readahead_active())
+		return readahead_error();
+
+	return ferror(globals.in);
+}
+
 int get_buffer_endian(void *buffer, size_t size, int print_error)
 {
 	int ret;
@@ -60,82 +83,140 @@ int get_buffer_endian(void *buffer, size_t size, int print_error)
 	return 0;
 }
 
-int convert_file(void)
+static int skip_payload(struct glide64_file *file)
+{
+	struct stat st;
+	off_t offset;
+	int fd;
+
+	fd = fileno(globals.in);
+	if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return -EOPNOTSUPP;
+
+	offset = ftello(globals.in);
+	if (offset < 0 || (uint64_t)offset + file->size > (uint64_t)st.st_size)
+		return -EOPNOTSUPP;
+
+	if (fseeko(globals.in, file->size, SEEK_CUR) < 0)
+		return -EIO;
+
+	globals.in_offset += file->size;
+	progress_add(&progress.bytes_in, file->size);
+
+	file->payload_fd = fd;
+	file->payload_offset = (uint64_t)offset;
+	file->payload_size = file->size;
+
+	return 0;
+}
+
+int read_file_header(struct glide64_file *file)
 {
-	struct glide64_file file;
 	int ret;
-	long pos = ftell(globals.in);
 
-	ret = get_buffer_endian(&file.checksum, sizeof(file.checksum), 0);
+	memset(file, 0, sizeof(*file));
+	file->prefix = globals.prefix;
+	file->offset = globals.in_offset;
+
+	ret = get_buffer_endian(&file->checksum, sizeof(file->checksum), 0);
 	if (ret < 0)
-		return 0;
+		return 1;
 
-	ret = get_item(file.width);
+	ret = get_item(file->width);
 	if (ret < 0) {
 		fprintf(stderr, "Failed to read file width\n");
 		return ret;
 	}
 
-	ret = get_item(file.height);
+	ret = get_item(file->height);
 	if (ret < 0) {
 		fprintf(stderr, "Failed to read file height\n");
 		return ret;
 	}
 
-	ret = get_item(file.format);
+	ret = get_item(file->format);
 	if (ret < 0) {
 		fprintf(stderr, "Failed to read file format\n");
 		return ret;
 	}
 
-	ret = get_item(file.smallLodLog2);
+	ret = get_item(file->smallLodLog2);
 	if (ret < 0) {
 		fprintf(stderr, "Failed to read file smallLodLog2\n");
 		return ret;
 	}
 
-	ret = get_item(file.largeLodLog2);
+	ret = get_item(file->largeLodLog2);
 	if (ret < 0) {
 		fprintf(stderr, "Failed to read file largeLodLog2\n");
 		return ret;
 	}
 
-	ret = get_item(file.aspectRatioLog2);
+	ret = get_item(file->aspectRatioLog2);
 	if (ret < 0) {
 		fprintf(stderr, "Failed to read file aspectRatioLog2\n");
 		return ret;
 	}
 
-	ret = get_item(file.tiles);
+	ret = get_item(file->tiles);
 	if (ret < 0) {
 		fprintf(stderr, "Failed to read file tiles\n");
 		return ret;
 	}
 
-	ret = get_item(file.untiled_width);
+	ret = get_item(file->untiled_width);
 	if (ret < 0) {
 		fprintf(stderr, "Failed to read file untiled_width\n");
 		return ret;
 	}
 
-	ret = get_item(file.untiled_height);
+	ret = get_item(file->untiled_height);
 	if (ret < 0) {
 		fprintf(stderr, "Failed to read file untiled_height\n");
 		return ret;
 	}
 
-	ret = get_item(file.is_hires_tex);
+	ret = get_item(file->is_hires_tex);
 	if (ret < 0) {
 		fprintf(stderr, "Failed to read file is_hires_tex\n");
 		return ret;
 	}
 
-	ret = get_item(file.size);
+	ret = get_item(file->size);
 	if (ret < 0) {
 		fprintf(stderr, "Failed to read filesize\n");
 		return ret;
 	}
 
+	file->cache_width = file->width;
+	file->cache_height = file->height;
+	file->cache_format = file->format;
+	file->cache_size = file->size;
+	file->record_size = globals.in_offset - file->offset + file->size;
+
+	return 0;
+}
+
+static int submit_file(struct glide64_file *file, uint64_t start)
+{
+	trace_end(file, "read", start);
+
+	return pipeline_submit(file);
+}
+
+int convert_file(void)
+{
+	struct glide64_file file;
+	int ret;
+	long pos = ftell(globals.in);
+	uint64_t start = trace_begin();
+
+	ret = read_file_header(&file);
+	if (ret > 0)
+		return 0;
+	if (ret < 0)
+		return ret;
+
 	if (globals.verbose >= VERBOSITY_FILE_HEADER) {
 		if (pos >= 0 && globals.in != stdin)
 			fprintf(stderr, "Offset: %#lx\n", pos);
@@ -157,10 +238,37 @@ int convert_file(void)
 	}
 
 	if (file.size <= 0) {
+		if (globals.mode == MODE_VERIFY)
+			return submit_file(&file, start);
+
 		fprintf(stderr, "Invalid filesize\n");
 		return ret;
 	}
 
+	/* uncompressed payloads only need a size check for verification */
+	if (globals.mode == MODE_VERIFY && !(file.format & GR_TEXFMT_GZ)) {
+		ret = skip_payload(&file);
+		if (ret == 0)
+			return submit_file(&file, start);
+	}
+
+	/* the analysis only needs the headers */
+	if (globals.mode == MODE_ANALYZE) {
+		ret = skip_payload(&file);
+		if (ret == 0)
+			return submit_file(&file, start);
+	}
+
+	/* unchanged payloads can be moved directly from input to output, the
+	 * contact sheets need the pixels of every texture
+	 */
+	if (globals.mode != MODE_SHEET && output_can_splice() &&
+	    file_passthrough(&file)) {
+		ret = skip_payload(&file);
+		if (ret == 0)
+			return submit_file(&file, start);
+	}
+
 	file.data = malloc(file.size);
 	if (!file.data) {
 		fprintf(stderr, "Could not allocate memory for file content\n");
@@ -173,22 +281,39 @@ int convert_file(void)
 		return ret;
 	}
 
-	ret = prepare_file(&file);
-	if (ret < 0) {
-		free(file.data);
+	/* textures which are already in the store are only linked again */
+	store_lookup(&file);
+
+	return submit_file(&file, start);
+}
+
+int export_file(struct glide64_file *file, int status)
+{
+	char name[100];
+	uint64_t start;
+	int ret;
+
+	if (status < 0) {
+		free(file->data);
+		metadata_file(file, NULL, "failed");
 		fprintf(stderr, "Failed to prepare file for export\n");
 		if (globals.ignore_error)
-			return 0;
+			return checkpoint_update(file);
 		else
-			return ret;
+			return status;
 	}
 
-	ret = write_file(&file);
-	free(file.data);
+	start = trace_begin();
+	ret = write_file(file);
+	trace_end(file, "write", start);
+	free(file->data);
 	if (ret < 0) {
 		fprintf(stderr, "Could not write file content\n");
 		return ret;
 	}
 
-	return 0;
+	file_name(file, name, sizeof(name));
+	metadata_file(file, name, "ok");
+
+	return checkpoint_update(file);
 }
@@ -0,0 +1,151 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* glide64_cache_extract, Glide64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+#include "glide64_cache_extract.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define METADATA_BUFFER_SIZE	(1024 * 1024)
+
+static FILE *metadata;
+static char *metadata_buf;
+static int metadata_resumed;
+
+int metadata_close(void)
+{
+	int ret = 0;
+
+	if (!metadata)
+		return 0;
+
+	if (fclose(metadata) != 0) {
+		fprintf(stderr, "Could not write metadata file\n");
+		ret = -EIO;
+	}
+
+	free(metadata_buf);
+	metadata = NULL;
+	metadata_buf = NULL;
+
+	return ret;
+}
+
+/* a resumed run keeps the first offset bytes of the existing file, a fresh
+ * run (negative offset) starts with an empty one
+ */
+int metadata_open(const char *path, int64_t offset)
+{
+	int ret;
+
+	/* only the last given file is written */
+	ret = metadata_close();
+	if (ret < 0)
+		return ret;
+
+	metadata = fopen(path, offset < 0 ? "w" : "a");
+	if (!metadata) {
+		fprintf(stderr, "Could not open metadata file %s\n", path);
+		return -ENOENT;
+	}
+
+	metadata_buf = malloc(METADATA_BUFFER_SIZE);
+	if (metadata_buf)
+		setvbuf(metadata, metadata_buf, _IOFBF, METADATA_BUFFER_SIZE);
+
+	if (offset >= 0 && (ftruncate(fileno(metadata), (off_t)offset) < 0 ||
+			    fseeko(metadata, 0, SEEK_END) < 0)) {
+		fprintf(stderr, "Could not truncate metadata file %s to checkpoint\n", path);
+		metadata_close();
+		return -EIO;
+	}
+	metadata_resumed = offset > 0;
+
+	return 0;
+}
+
+int metadata_sync(uint64_t *offset)
+{
+	off_t pos;
+
+	*offset = 0;
+	if (!metadata)
+		return 0;
+
+	pos = ftello(metadata);
+	if (fflush(metadata) != 0 || pos < 0) {
+		fprintf(stderr, "Could not write metadata file\n");
+		return -EIO;
+	}
+
+	*offset = (uint64_t)pos;
+
+	return 0;
+}
+
+static void metadata_string(const char *str)
+{
+	const unsigned char *pos = (const unsigned char *)str;
+
+	if (!str) {
+		fputs("null", metadata);
+		return;
+	}
+
+	putc('"', metadata);
+	for (; *pos; pos++) {
+		if (*pos == '"' || *pos == '\\') {
+			putc('\\', metadata);
+			putc(*pos, metadata);
+		} else if (*pos < 0x20) {
+			fprintf(metadata, "\\u%04x", *pos);
+		} else {
+			putc(*pos, metadata);
+		}
+	}
+	putc('"', metadata);
+}
+
+void metadata_config(uint32_t config)
+{
+	/* the interrupted run already wrote it */
+	if (!metadata || metadata_resumed)
+		return;
+
+	fputs("{\"type\":\"config\",\"prefix\":", metadata);
+	metadata_string(globals.prefix);
+	fprintf(metadata, ",\"config\":%"PRIu32"}\n", config);
+}
+
+void metadata_file(const struct glide64_file *file, const char *name,
+		   const char *status)
+{
+	if (!metadata)
+		return;
+
+	fputs("{\"type\":\"file\",\"prefix\":", metadata);
+	metadata_string(file->prefix);
+	fprintf(metadata,
+		",\"offset\":%"PRIu64",\"checksum\":\"%016"PRIX64"\",\"width\":%"PRIu32",\"height\":%"PRIu32",\"format\":%"PRIu16",\"smallLodLog2\":%"PRIu32",\"largeLodLog2\":%"PRIu32",\"aspectRatioLog2\":%"PRIu32",\"tiles\":%"PRIu32",\"untiled_width\":%"PRIu32",\"untiled_height\":%"PRIu32",\"is_hires_tex\":%"PRIu8",\"size\":%"PRIu32",\"name\":",
+		file->offset, file->checksum, file->cache_width, file->cache_height,
+		file->cache_format, file->smallLodLog2, file->largeLodLog2,
+		file->aspectRatioLog2, file->tiles, file->untiled_width,
+		file->untiled_height, file->is_hires_tex, file->cache_size);
+	metadata_string(name);
+	if (name)
+		fprintf(metadata, ",\"output_width\":%"PRIu32",\"output_height\":%"PRIu32",\"output_size\":%"PRIu32,
+			file->width, file->height, file->size);
+	else
+		fputs(",\"output_width\":null,\"output_height\":null,\"output_size\":null", metadata);
+	fputs(",\"status\":", metadata);
+	metadata_string(status);
+	fputs("}\n", metadata);
+}
@@ -0,0 +1,764 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* glide64_cache_extract, Glide64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+#define _GNU_SOURCE
+#include "glide64_cache_extract.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#define HAVE_IO_URING 1
+#endif
+
+enum output_backend {
+	OUTPUT_STDIO = 0,
+	OUTPUT_WRITE,
+	OUTPUT_URING,
+	OUTPUT_PIPE,
+};
+
+#define PIPE_BUFFER_SIZE	(256 * 1024)
+#define PIPE_SIZE		(1024 * 1024)
+
+#ifdef HAVE_IO_URING
+
+#define URING_BUFFERS		8
+#define URING_BUFFER_SIZE	(512 * 1024)
+
+struct uring {
+	int fd;
+	void *sq_ptr;
+	size_t sq_len;
+	void *cq_ptr;
+	size_t cq_len;
+	struct io_uring_sqe *sqes;
+	size_t sqes_len;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+	uint8_t *buffers[URING_BUFFERS];
+	uint64_t offsets[URING_BUFFERS];
+	size_t lengths[URING_BUFFERS];
+	int busy[URING_BUFFERS];
+	unsigned int inflight;
+	unsigned int current;
+	size_t fill;
+};
+
+#endif
+
+static struct {
+	enum output_backend backend;
+	FILE *out;
+	int fd;
+	uint64_t offset;
+	int error;
+#ifdef HAVE_IO_URING
+	struct uring ring;
+#endif
+	uint8_t *pipe_buf;
+	size_t pipe_fill;
+} output;
+
+static int write_all(int fd, const void *buffer, size_t size)
+{
+	const uint8_t *pos = buffer;
+	ssize_t ret;
+
+	while (size) {
+		ret = write(fd, pos, size);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -EIO;
+
+		pos += ret;
+		size -= (size_t)ret;
+	}
+
+	return 0;
+}
+
+static int pwrite_all(int fd, const void *buffer, size_t size, uint64_t offset)
+{
+	const uint8_t *pos = buffer;
+	ssize_t ret;
+
+	while (size) {
+		ret = pwrite(fd, pos, size, (off_t)offset);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -EIO;
+
+		pos += ret;
+		size -= (size_t)ret;
+		offset += (uint64_t)ret;
+	}
+
+	return 0;
+}
+
+#ifdef HAVE_IO_URING
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit,
+			      unsigned int min_complete, unsigned int flags)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+			    flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned int opcode, void *arg,
+				 unsigned int nr_args)
+{
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void uring_free(struct uring *ring)
+{
+	unsigned int i;
+
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_len);
+	if (ring->cq_ptr && ring->cq_ptr != ring->sq_ptr)
+		munmap(ring->cq_ptr, ring->cq_len);
+	if (ring->sq_ptr)
+		munmap(ring->sq_ptr, ring->sq_len);
+	if (ring->fd >= 0)
+		close(ring->fd);
+
+	for (i = 0; i < URING_BUFFERS; i++)
+		free(ring->buffers[i]);
+
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+}
+
+static int uring_init(struct uring *ring)
+{
+	struct iovec iov[URING_BUFFERS];
+	struct io_uring_params p;
+	uint8_t *sq, *cq;
+	unsigned int i;
+	int ret;
+
+	memset(ring, 0, sizeof(*ring));
+	memset(&p, 0, sizeof(p));
+
+	ring->fd = sys_io_uring_setup(URING_BUFFERS, &p);
+	if (ring->fd < 0) {
+		ring->fd = -1;
+		return -ENOSYS;
+	}
+
+	ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_len > ring->sq_len)
+			ring->sq_len = ring->cq_len;
+		ring->cq_len = ring->sq_len;
+	}
+
+	ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ptr == MAP_FAILED) {
+		ring->sq_ptr = NULL;
+		goto err;
+	}
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ptr = ring->sq_ptr;
+	} else {
+		ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+				    MAP_SHARED | MAP_POPULATE, ring->fd,
+				    IORING_OFF_CQ_RING);
+		if (ring->cq_ptr == MAP_FAILED) {
+			ring->cq_ptr = NULL;
+			goto err;
+		}
+	}
+
+	ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		goto err;
+	}
+
+	sq = ring->sq_ptr;
+	ring->sq_head = (unsigned int *)(sq + p.sq_off.head);
+	ring->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+	ring->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned int *)(sq + p.sq_off.array);
+
+	cq = ring->cq_ptr;
+	ring->cq_head = (unsigned int *)(cq + p.cq_off.head);
+	ring->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+	ring->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	for (i = 0; i < URING_BUFFERS; i++) {
+		ret = posix_memalign((void **)&ring->buffers[i], 4096,
+				     URING_BUFFER_SIZE);
+		if (ret) {
+			ring->buffers[i] = NULL;
+			goto err;
+		}
+
+		iov[i].iov_base = ring->buffers[i];
+		iov[i].iov_len = URING_BUFFER_SIZE;
+	}
+
+	ret = sys_io_uring_register(ring->fd, IORING_REGISTER_BUFFERS, iov,
+				    URING_BUFFERS);
+	if (ret < 0)
+		goto err;
+
+	return 0;
+
+err:
+	uring_free(ring);
+	return -ENOSYS;
+}
+
+static int uring_reap(struct uring *ring, unsigned int min_complete)
+{
+	struct io_uring_cqe *cqe;
+	unsigned int head, tail;
+	unsigned int idx;
+	size_t done;
+	int ret;
+
+	if (min_complete) {
+		ret = sys_io_uring_enter(ring->fd, 0, min_complete,
+					 IORING_ENTER_GETEVENTS);
+		if (ret < 0 && errno != EINTR)
+			return -EIO;
+	}
+
+	head = *ring->cq_head;
+	tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+	for (; head != tail; head++) {
+		cqe = &ring->cqes[head & *ring->cq_mask];
+		idx = (unsigned int)cqe->user_data;
+
+		if (cqe->res < 0) {
+			output.error = -EIO;
+		} else if ((size_t)cqe->res < ring->lengths[idx]) {
+			/* finish short writes synchronously */
+			done = (size_t)cqe->res;
+			ret = pwrite_all(output.fd, ring->buffers[idx] + done,
+					 ring->lengths[idx] - done,
+					 ring->offsets[idx] + done);
+			if (ret < 0)
+				output.error = ret;
+		}
+
+		ring->busy[idx] = 0;
+		ring->inflight--;
+	}
+
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+	return output.error;
+}
+
+static int uring_submit(struct uring *ring)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int idx = ring->current;
+	unsigned int tail;
+	int ret;
+
+	if (!ring->fill)
+		return 0;
+
+	ring->offsets[idx] = output.offset;
+	ring->lengths[idx] = ring->fill;
+	ring->busy[idx] = 1;
+	ring->inflight++;
+
+	tail = *ring->sq_tail;
+	sqe = &ring->sqes[tail & *ring->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_WRITE_FIXED;
+	sqe->fd = output.fd;
+	sqe->addr = (uintptr_t)ring->buffers[idx];
+	sqe->len = (uint32_t)ring->fill;
+	sqe->off = output.offset;
+	sqe->buf_index = (uint16_t)idx;
+	sqe->user_data = idx;
+	ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	output.offset += ring->fill;
+	ring->fill = 0;
+
+	do {
+		ret = sys_io_uring_enter(ring->fd, 1, 0, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0)
+		return -EIO;
+
+	return 0;
+}
+
+/* switch to the next buffer which is not owned by the kernel anymore */
+static int uring_next_buffer(struct uring *ring)
+{
+	unsigned int i;
+	int ret;
+
+	while (1) {
+		ret = uring_reap(ring, 0);
+		if (ret < 0)
+			return ret;
+
+		for (i = 0; i < URING_BUFFERS; i++) {
+			if (!ring->busy[i]) {
+				ring->current = i;
+				return 0;
+			}
+		}
+
+		ret = uring_reap(ring, 1);
+		if (ret < 0)
+			return ret;
+	}
+}
+
+static int uring_write(struct uring *ring, const void *buffer, size_t size)
+{
+	const uint8_t *pos = buffer;
+	size_t len;
+	int ret;
+
+	while (size) {
+		len = URING_BUFFER_SIZE - ring->fill;
+		if (len > size)
+			len = size;
+
+		memcpy(ring->buffers[ring->current] + ring->fill, pos, len);
+		ring->fill += len;
+		pos += len;
+		size -= len;
+
+		if (ring->fill == URING_BUFFER_SIZE) {
+			ret = uring_submit(ring);
+			if (ret < 0)
+				return ret;
+
+			ret = uring_next_buffer(ring);
+			if (ret < 0)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+static int uring_flush(struct uring *ring)
+{
+	int ret;
+
+	ret = uring_submit(ring);
+	if (ret < 0)
+		return ret;
+
+	while (ring->inflight) {
+		ret = uring_reap(ring, 1);
+		if (ret < 0)
+			return ret;
+	}
+
+	return output.error;
+}
+
+#endif
+
+#if defined(__linux__)
+
+/* the buffer is gifted to the pipe and must not be touched afterwards */
+static int pipe_flush(void)
+{
+	struct iovec iov;
+	ssize_t ret;
+	int err = 0;
+
+	if (!output.pipe_buf)
+		return 0;
+
+	iov.iov_base = output.pipe_buf;
+	iov.iov_len = output.pipe_fill;
+
+	while (iov.iov_len) {
+		ret = vmsplice(output.fd, &iov, 1, SPLICE_F_GIFT);
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret <= 0) {
+			err = write_all(output.fd, iov.iov_base, iov.iov_len);
+			break;
+		}
+
+		iov.iov_base = (uint8_t *)iov.iov_base + ret;
+		iov.iov_len -= (size_t)ret;
+	}
+
+	munmap(output.pipe_buf, PIPE_BUFFER_SIZE);
+	output.pipe_buf = NULL;
+	output.pipe_fill = 0;
+
+	return err;
+}
+
+static int pipe_write(const void *buffer, size_t size)
+{
+	const uint8_t *pos = buffer;
+	size_t len;
+	void *buf;
+	int ret;
+
+	while (size) {
+		if (!output.pipe_buf) {
+			buf = mmap(NULL, PIPE_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+				   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (buf == MAP_FAILED)
+				return -ENOMEM;
+
+			output.pipe_buf = buf;
+			output.pipe_fill = 0;
+		}
+
+		len = PIPE_BUFFER_SIZE - output.pipe_fill;
+		if (len > size)
+			len = size;
+
+		memcpy(output.pipe_buf + output.pipe_fill, pos, len);
+		output.pipe_fill += len;
+		pos += len;
+		size -= len;
+
+		if (output.pipe_fill == PIPE_BUFFER_SIZE) {
+			ret = pipe_flush();
+			if (ret < 0)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+static int pipe_splice(int fd, uint64_t offset, size_t size)
+{
+	loff_t off = (loff_t)offset;
+	ssize_t ret;
+
+	ret = pipe_flush();
+	if (ret < 0)
+		return (int)ret;
+
+	while (size) {
+		ret = splice(fd, &off, output.fd, NULL, size,
+			     SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -EIO;
+
+		size -= (size_t)ret;
+	}
+
+	return 0;
+}
+
+/* copy between regular files without moving the data through user space,
+ * falls back to pread/pwrite when the filesystems don't support it
+ */
+static int file_copy(int fd, uint64_t offset, size_t size, uint64_t out_offset)
+{
+	loff_t off_in = (loff_t)offset;
+	loff_t off_out = (loff_t)out_offset;
+	uint8_t buf[64 * 1024];
+	ssize_t ret;
+	size_t len;
+
+	while (size) {
+		ret = copy_file_range(fd, &off_in, output.fd, &off_out, size, 0);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0 && (errno == EXDEV || errno == ENOSYS ||
+				errno == EINVAL || errno == EOPNOTSUPP))
+			break;
+		if (ret <= 0)
+			return -EIO;
+
+		size -= (size_t)ret;
+	}
+
+	while (size) {
+		len = size > sizeof(buf) ? sizeof(buf) : size;
+
+		ret = pread(fd, buf, len, off_in);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -EIO;
+
+		if (pwrite_all(output.fd, buf, (size_t)ret, (uint64_t)off_out) < 0)
+			return -EIO;
+
+		off_in += ret;
+		off_out += ret;
+		size -= (size_t)ret;
+	}
+
+	return 0;
+}
+
+#endif
+
+int output_open(FILE *out)
+{
+	struct stat st;
+	off_t offset;
+
+	memset(&output, 0, sizeof(output));
+	output.out = out;
+	output.backend = OUTPUT_STDIO;
+	output.fd = fileno(out);
+
+	if (output.fd < 0 || fstat(output.fd, &st) < 0)
+		return 0;
+
+#if defined(__linux__)
+	if (S_ISFIFO(st.st_mode)) {
+		if (fflush(out) != 0)
+			return -EIO;
+
+		fcntl(output.fd, F_SETPIPE_SZ, PIPE_SIZE);
+		output.backend = OUTPUT_PIPE;
+		return 0;
+	}
+#endif
+
+	if (!S_ISREG(st.st_mode))
+		return 0;
+
+	/* regular files are written directly to the file descriptor */
+	if (fflush(out) != 0)
+		return -EIO;
+
+	offset = lseek(output.fd, 0, SEEK_CUR);
+	if (offset < 0)
+		return 0;
+
+	output.offset = (uint64_t)offset;
+	output.backend = OUTPUT_WRITE;
+
+#ifdef HAVE_IO_URING
+	if (uring_init(&output.ring) == 0)
+		output.backend = OUTPUT_URING;
+#endif
+
+	return 0;
+}
+
+int output_write(const void *buffer, size_t size)
+{
+	int ret;
+
+	progress_add(&progress.bytes_out, size);
+
+	switch (output.backend) {
+#ifdef HAVE_IO_URING
+	case OUTPUT_URING:
+		return uring_write(&output.ring, buffer, size);
+#endif
+#if defined(__linux__)
+	case OUTPUT_PIPE:
+		return pipe_write(buffer, size);
+#endif
+	case OUTPUT_WRITE:
+		ret = write_all(output.fd, buffer, size);
+		if (ret < 0)
+			return ret;
+
+		output.offset += size;
+		return 0;
+	case OUTPUT_STDIO:
+	default:
+		if (fwrite(buffer, 1, size, output.out) != size)
+			return -EIO;
+
+		return 0;
+	}
+}
+
+int output_can_splice(void)
+{
+#if defined(__linux__)
+	return output.backend == OUTPUT_PIPE ||
+	       output.backend == OUTPUT_WRITE ||
+	       output.backend == OUTPUT_URING;
+#else
+	return 0;
+#endif
+}
+
+int output_splice(int fd, uint64_t offset, size_t size)
+{
+	int ret;
+
+	progress_add(&progress.bytes_out, size);
+
+	switch (output.backend) {
+#ifdef HAVE_IO_URING
+	case OUTPUT_URING:
+		/* queued writes end before the copied range starts */
+		ret = uring_submit(&output.ring);
+		if (ret < 0)
+			return ret;
+
+		ret = uring_next_buffer(&output.ring);
+		if (ret < 0)
+			return ret;
+
+		ret = file_copy(fd, offset, size, output.offset);
+		if (ret < 0)
+			return ret;
+
+		output.offset += size;
+		return 0;
+#endif
+#if defined(__linux__)
+	case OUTPUT_PIPE:
+		return pipe_splice(fd, offset, size);
+	case OUTPUT_WRITE:
+		ret = file_copy(fd, offset, size, output.offset);
+		if (ret < 0)
+			return ret;
+
+		output.offset += size;
+		if (lseek(output.fd, (off_t)output.offset, SEEK_SET) < 0)
+			return -EIO;
+
+		return 0;
+#endif
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+uint64_t output_tell(void)
+{
+	off_t offset;
+
+#ifdef HAVE_IO_URING
+	/* the filled buffer is not yet submitted */
+	if (output.backend == OUTPUT_URING)
+		return output.offset + output.ring.fill;
+#endif
+
+	if (output.backend != OUTPUT_STDIO)
+		return output.offset;
+
+	offset = ftello(output.out);
+	if (offset < 0)
+		return 0;
+
+	return (uint64_t)offset;
+}
+
+/* make everything written so far durable */
+int output_sync(void)
+{
+	int ret;
+
+	switch (output.backend) {
+#ifdef HAVE_IO_URING
+	case OUTPUT_URING:
+		ret = uring_flush(&output.ring);
+		if (ret < 0)
+			return ret;
+		break;
+#endif
+	case OUTPUT_PIPE:
+		return 0;
+	case OUTPUT_WRITE:
+		break;
+	case OUTPUT_STDIO:
+	default:
+		if (fflush(output.out) != 0)
+			return -EIO;
+		break;
+	}
+
+	if (fdatasync(output.fd) < 0)
+		return -EIO;
+
+	return 0;
+}
+
+int output_close(void)
+{
+	int ret = 0;
+
+	switch (output.backend) {
+#ifdef HAVE_IO_URING
+	case OUTPUT_URING:
+		ret = uring_flush(&output.ring);
+		uring_free(&output.ring);
+		if (lseek(output.fd, (off_t)output.offset, SEEK_SET) < 0 && ret >= 0)
+			ret = -EIO;
+		break;
+#endif
+#if defined(__linux__)
+	case OUTPUT_PIPE:
+		ret = pipe_flush();
+		break;
+#endif
+	case OUTPUT_WRITE:
+		break;
+	case OUTPUT_STDIO:
+	default:
+		if (fflush(output.out) != 0)
+			ret = -EIO;
+		break;
+	}
+
+	output.backend = OUTPUT_STDIO;
+
+	return ret;
+}
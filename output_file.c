@@ -16,10 +16,11 @@ uint8_t tarblock[512];
 
 int write_tarblock(void *buffer, size_t size, size_t offset)
 {
-	size_t ret, padding_size;
+	size_t padding_size;
+	int ret;
 
-	ret = fwrite(buffer, 1, size, globals.out);
-	if (ret != size) {
+	ret = output_write(buffer, size);
+	if (ret < 0) {
 		fprintf(stderr, "Could not write file content\n");
 		return -EIO;
 	}
@@ -28,8 +29,8 @@ int write_tarblock(void *buffer, size_t size, size_t offset)
 	if (padding_size) {
 		padding_size = sizeof(tarblock) - padding_size;
 
-		ret = fwrite(tarblock, 1, padding_size, globals.out);
-		if (ret != padding_size) {
+		ret = output_write(tarblock, padding_size);
+		if (ret < 0) {
 			fprintf(stderr, "Could not write padding\n");
 			return -EIO;
 		}
@@ -40,31 +41,43 @@ int write_tarblock(void *buffer, size_t size, size_t offset)
 
 static const char *image_extension(const struct glide64_file *file)
 {
-	switch (file->format) {
-	case GR_TEXFMT_ALPHA_8:
-	case GR_TEXFMT_INTENSITY_8:
-	case GR_TEXFMT_ALPHA_INTENSITY_44:
-	case GR_TEXFMT_P_8:
-	case GR_TEXFMT_RGB_565:
-	case GR_TEXFMT_ARGB_1555:
-	case GR_TEXFMT_ARGB_4444:
-	case GR_TEXFMT_ALPHA_INTENSITY_88:
-	case GR_TEXFMT_ARGB_8888:
-		return "bmp";
-	case GR_TEXFMT_ARGB_CMP_FXT1:
-		fprintf(stderr, "Unsupported format GR_TEXFMT_ARGB_CMP_FXT1\n");
+	const struct texture_format *fmt;
+
+	fmt = texture_format_get(file->format);
+	if (!fmt) {
+		fprintf(stderr, "Unsupported format %x\n", file->format);
 		return "";
-	case GR_TEXFMT_ARGB_CMP_DXT1:
-	case GR_TEXFMT_ARGB_CMP_DXT3:
-	case GR_TEXFMT_ARGB_CMP_DXT5:
+	}
+
+	switch (texture_container_get(fmt)) {
+	case CONTAINER_BMP:
+		return "bmp";
+	case CONTAINER_DDS:
 		return "dds";
 	default:
-		fprintf(stderr, "Unsupported format %x\n", file->format);
+		fprintf(stderr, "Unsupported format GR_TEXFMT_%s\n", fmt->name);
 		return "";
 	}
 }
 
-int write_file(struct glide64_file *file)
+void file_name(const struct glide64_file *file, char *name, size_t size)
+{
+	if (file->name) {
+		snprintf(name, size, "%s", file->name);
+		return;
+	}
+
+	/* TODO fix this test by identifying ci mode with palette, set fmt+size in name */
+	if ((uint32_t)(file->checksum >> 32) != 0)
+		snprintf(name, size, "%s#%08"PRIX32"#%01"PRIX32"#%01"PRIX32"#%08"PRIX32"_ciByRGBA.%s", file->prefix, (uint32_t)file->checksum, 3 , 0, (uint32_t)(file->checksum >> 32), image_extension(file));
+	else
+		snprintf(name, size, "%s#%08"PRIX32"#%01"PRIX32"#%01"PRIX32"_all.%s", file->prefix, (uint32_t)file->checksum, 3 , 0, image_extension(file));
+
+	name[size - 1] = '\0';
+}
+
+static int write_tar_header(const char *name, uint32_t size, char type,
+			    const char *target)
 {
 	struct tar_header tarheader;
 	uint8_t *raw_header;
@@ -74,25 +87,21 @@ int write_file(struct glide64_file *file)
 
 	memset(&tarheader, 0, sizeof(tarheader));
 
-	/* TODO fix this test by identifying ci mode with palette, set fmt+size in name */
-	if ((uint32_t)(file->checksum >> 32) != 0)
-		snprintf(tarheader.name, sizeof(tarheader.name), "%s#%08"PRIX32"#%01"PRIX32"#%01"PRIX32"#%08"PRIX32"_ciByRGBA.%s", globals.prefix, (uint32_t)file->checksum, 3 , 0, (uint32_t)(file->checksum >> 32), image_extension(file));
-	else
-		snprintf(tarheader.name, sizeof(tarheader.name), "%s#%08"PRIX32"#%01"PRIX32"#%01"PRIX32"_all.%s", globals.prefix, (uint32_t)file->checksum, 3 , 0, image_extension(file));
+	snprintf(tarheader.name, sizeof(tarheader.name), "%s", name);
 
-	tarheader.name[sizeof(tarheader.name) - 1] = '\0';
-
-	strcpy(tarheader.mode, "0000644");
+	strcpy(tarheader.mode, type ? "0000777" : "0000644");
 	strcpy(tarheader.uid, "0000000");
 	strcpy(tarheader.gid, "0000000");
 
-	snprintf(tarheader.size, sizeof(tarheader.size), "%011"PRIo32, file->size);
+	snprintf(tarheader.size, sizeof(tarheader.size), "%011"PRIo32, size);
 	tarheader.size[sizeof(tarheader.size) - 1] = '\0';
 
 	snprintf(tarheader.mtime, sizeof(tarheader.mtime), "%011o", 1);
 	tarheader.mtime[sizeof(tarheader.mtime) - 1] = '\0';
 	memset(tarheader.chksum, ' ', sizeof(tarheader.chksum));
-	tarheader.link = 0;
+	tarheader.link = type;
+	if (target)
+		strncpy(tarheader.linkname, target, sizeof(tarheader.linkname));
 
 	raw_header = (void *)&tarheader;
 	for (i = 0; i < sizeof(tarheader); i++)
@@ -107,7 +116,53 @@ int write_file(struct glide64_file *file)
 		return ret;
 	}
 
-	ret = write_tarblock(file->data, file->size, 0);
+	return 0;
+}
+
+int write_tar_link(const char *name, const char *target)
+{
+	return write_tar_header(name, 0, '2', target);
+}
+
+int write_file(struct glide64_file *file)
+{
+	char name[100];
+	int ret;
+
+	if (globals.archive != ARCHIVE_TAR)
+		return zip_write_file(file);
+
+	if (globals.store_dir)
+		return store_write_file(file);
+
+	file_name(file, name, sizeof(name));
+	ret = write_tar_header(name, file->size, 0, NULL);
+	if (ret < 0)
+		return ret;
+
+	if (!file->payload_size) {
+		ret = write_tarblock(file->data, file->size, 0);
+		if (ret < 0) {
+			fprintf(stderr, "Failed to write file content\n");
+			return ret;
+		}
+
+		return 0;
+	}
+
+	ret = output_write(file->data, file->size - file->payload_size);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to write file content\n");
+		return ret;
+	}
+
+	ret = output_splice(file->payload_fd, file->payload_offset, file->payload_size);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to copy file content from input\n");
+		return ret;
+	}
+
+	ret = write_tarblock(tarblock, 0, file->size);
 	if (ret < 0) {
 		fprintf(stderr, "Failed to write file content\n");
 		return ret;
@@ -0,0 +1,240 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* glide64_cache_extract, Glide64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+#include "glide64_cache_extract.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Records are processed by a pool of worker threads but are always
+ * finished in the order in which they were submitted. The reader thread
+ * submits records and finishes (writes) the oldest one when the ring is
+ * full. Any idle worker picks up the next queued record - independent of
+ * the input it came from.
+ */
+
+#define PIPELINE_SLOTS_PER_THREAD	4
+
+enum job_state {
+	JOB_QUEUED = 0,
+	JOB_RUNNING,
+	JOB_DONE,
+};
+
+struct pipeline_job {
+	struct glide64_file file;
+	enum job_state state;
+	int ret;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t queued;
+	pthread_cond_t done;
+	pthread_t *threads;
+	unsigned int nthreads;
+	struct pipeline_job *jobs;
+	size_t slots;
+	size_t head;
+	size_t next;
+	size_t tail;
+	int stop;
+	pipeline_process_t process;
+	pipeline_finish_t finish;
+} pipeline;
+
+static void *pipeline_worker(void *arg __attribute__((unused)))
+{
+	struct pipeline_job *job;
+	int ret;
+
+	pthread_mutex_lock(&pipeline.lock);
+	while (1) {
+		while (!pipeline.stop && pipeline.next == pipeline.tail)
+			pthread_cond_wait(&pipeline.queued, &pipeline.lock);
+
+		if (pipeline.next == pipeline.tail)
+			break;
+
+		job = &pipeline.jobs[pipeline.next % pipeline.slots];
+		pipeline.next++;
+		job->state = JOB_RUNNING;
+		pthread_mutex_unlock(&pipeline.lock);
+
+		ret = pipeline.process(&job->file);
+
+		pthread_mutex_lock(&pipeline.lock);
+		job->ret = ret;
+		job->state = JOB_DONE;
+		pthread_cond_broadcast(&pipeline.done);
+	}
+	pthread_mutex_unlock(&pipeline.lock);
+
+	return NULL;
+}
+
+int pipeline_init(unsigned int jobs, pipeline_process_t process,
+		  pipeline_finish_t finish)
+{
+	unsigned int i;
+	int ret;
+
+	memset(&pipeline, 0, sizeof(pipeline));
+	pipeline.process = process;
+	pipeline.finish = finish;
+
+	/* the reader thread does the work itself when no pool is requested */
+	if (jobs <= 1)
+		return 0;
+
+	pipeline.slots = jobs * PIPELINE_SLOTS_PER_THREAD;
+	pipeline.jobs = calloc(pipeline.slots, sizeof(*pipeline.jobs));
+	pipeline.threads = calloc(jobs, sizeof(*pipeline.threads));
+	if (!pipeline.jobs || !pipeline.threads) {
+		fprintf(stderr, "Could not allocate memory for worker threads\n");
+		free(pipeline.jobs);
+		free(pipeline.threads);
+		return -ENOMEM;
+	}
+
+	pthread_mutex_init(&pipeline.lock, NULL);
+	pthread_cond_init(&pipeline.queued, NULL);
+	pthread_cond_init(&pipeline.done, NULL);
+
+	for (i = 0; i < jobs; i++) {
+		ret = pthread_create(&pipeline.threads[i], NULL, pipeline_worker, NULL);
+		if (ret) {
+			fprintf(stderr, "Could not start worker thread\n");
+			pipeline_exit();
+			return -ret;
+		}
+
+		pipeline.nthreads++;
+	}
+
+	return 0;
+}
+
+static int pipeline_finish(struct glide64_file *file, int status)
+{
+	progress_add(&progress.records, 1);
+
+	return pipeline.finish(file, status);
+}
+
+static int pipeline_finish_head(void)
+{
+	struct pipeline_job *job;
+
+	job = &pipeline.jobs[pipeline.head % pipeline.slots];
+
+	pthread_mutex_lock(&pipeline.lock);
+	while (job->state != JOB_DONE)
+		pthread_cond_wait(&pipeline.done, &pipeline.lock);
+	pthread_mutex_unlock(&pipeline.lock);
+
+	pipeline.head++;
+
+	return pipeline_finish(&job->file, job->ret);
+}
+
+int pipeline_submit(struct glide64_file *file)
+{
+	struct pipeline_job *job;
+	int ret;
+
+	if (!pipeline.nthreads)
+		return pipeline_finish(file, pipeline.process(file));
+
+	while (pipeline.tail - pipeline.head == pipeline.slots) {
+		ret = pipeline_finish_head();
+		if (ret < 0) {
+			free(file->data);
+			return ret;
+		}
+	}
+
+	job = &pipeline.jobs[pipeline.tail % pipeline.slots];
+	job->file = *file;
+	job->state = JOB_QUEUED;
+	job->ret = 0;
+
+	pthread_mutex_lock(&pipeline.lock);
+	pipeline.tail++;
+	pthread_cond_signal(&pipeline.queued);
+	pthread_mutex_unlock(&pipeline.lock);
+
+	return 0;
+}
+
+int pipeline_flush(void)
+{
+	int ret;
+
+	if (!pipeline.nthreads)
+		return 0;
+
+	while (pipeline.head != pipeline.tail) {
+		ret = pipeline_finish_head();
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/* wait for all queued records and drop them without finishing them */
+void pipeline_discard(void)
+{
+	struct pipeline_job *job;
+
+	if (!pipeline.nthreads)
+		return;
+
+	pthread_mutex_lock(&pipeline.lock);
+	for (; pipeline.head != pipeline.tail; pipeline.head++) {
+		job = &pipeline.jobs[pipeline.head % pipeline.slots];
+		while (job->state != JOB_DONE)
+			pthread_cond_wait(&pipeline.done, &pipeline.lock);
+
+		free(job->file.data);
+	}
+	pthread_mutex_unlock(&pipeline.lock);
+}
+
+void pipeline_exit(void)
+{
+	unsigned int i;
+
+	if (!pipeline.threads)
+		return;
+
+	pthread_mutex_lock(&pipeline.lock);
+	pipeline.stop = 1;
+	pthread_cond_broadcast(&pipeline.queued);
+	pthread_mutex_unlock(&pipeline.lock);
+
+	for (i = 0; i < pipeline.nthreads; i++)
+		pthread_join(pipeline.threads[i], NULL);
+
+	/* drop records which were never finished because of an error */
+	for (; pipeline.head != pipeline.tail; pipeline.head++)
+		free(pipeline.jobs[pipeline.head % pipeline.slots].file.data);
+
+	pthread_cond_destroy(&pipeline.done);
+	pthread_cond_destroy(&pipeline.queued);
+	pthread_mutex_destroy(&pipeline.lock);
+
+	free(pipeline.jobs);
+	free(pipeline.threads);
+	pipeline.jobs = NULL;
+	pipeline.threads = NULL;
+	pipeline.nthreads = 0;
+}
@@ -0,0 +1,167 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* glide64_cache_extract, Glide64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+#include "glide64_cache_extract.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* The counters are only updated with relaxed atomic additions. All
+ * formatting is done by a separate reporter thread which wakes up a few
+ * times per second.
+ */
+
+#define PROGRESS_INTERVAL_MS	250
+
+struct progress_counters progress;
+
+static struct {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wakeup;
+	int running;
+	int stop;
+	uint64_t start;
+} reporter = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.wakeup = PTHREAD_COND_INITIALIZER,
+};
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000ULL + (uint64_t)ts.tv_nsec / 1000000ULL;
+}
+
+static void write_line(int fd, const char *line, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = write(fd, line, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return;
+
+		line += ret;
+		len -= (size_t)ret;
+	}
+}
+
+static void progress_report(int final)
+{
+	uint64_t records, bytes_in, bytes_out, total_in;
+	uint64_t elapsed, rate_in, rate_records, eta;
+	char line[256];
+	int len;
+
+	records = __atomic_load_n(&progress.records, __ATOMIC_RELAXED);
+	bytes_in = __atomic_load_n(&progress.bytes_in, __ATOMIC_RELAXED);
+	bytes_out = __atomic_load_n(&progress.bytes_out, __ATOMIC_RELAXED);
+	total_in = __atomic_load_n(&progress.total_in, __ATOMIC_RELAXED);
+
+	elapsed = now_ms() - reporter.start;
+	if (!elapsed)
+		elapsed = 1;
+
+	rate_in = bytes_in * 1000 / elapsed;
+	rate_records = records * 1000 / elapsed;
+
+	eta = 0;
+	if (rate_in && total_in > bytes_in)
+		eta = (total_in - bytes_in) / rate_in;
+
+	if (globals.progress) {
+		len = snprintf(line, sizeof(line),
+			       "\r%"PRIu64" records, in %.1f MiB, out %.1f MiB, %.1f MiB/s, %"PRIu64" textures/s, ETA %"PRIu64":%02"PRIu64"%s",
+			       records, bytes_in / 1048576.0, bytes_out / 1048576.0,
+			       rate_in / 1048576.0, rate_records, eta / 60, eta % 60,
+			       final ? "\n" : "");
+		if (len > 0)
+			write_line(STDERR_FILENO, line, (size_t)len);
+	}
+
+	if (globals.progress_fd >= 0) {
+		len = snprintf(line, sizeof(line),
+			       "records=%"PRIu64" bytes_in=%"PRIu64" bytes_out=%"PRIu64" total_in=%"PRIu64" elapsed_ms=%"PRIu64" eta_s=%"PRIu64" done=%d\n",
+			       records, bytes_in, bytes_out, total_in, elapsed,
+			       eta, final);
+		if (len > 0)
+			write_line(globals.progress_fd, line, (size_t)len);
+	}
+}
+
+static void *progress_thread(void *arg __attribute__((unused)))
+{
+	struct timespec deadline;
+
+	pthread_mutex_lock(&reporter.lock);
+	while (!reporter.stop) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += PROGRESS_INTERVAL_MS * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+
+		pthread_cond_timedwait(&reporter.wakeup, &reporter.lock, &deadline);
+		if (reporter.stop)
+			break;
+
+		pthread_mutex_unlock(&reporter.lock);
+		progress_report(0);
+		pthread_mutex_lock(&reporter.lock);
+	}
+	pthread_mutex_unlock(&reporter.lock);
+
+	return NULL;
+}
+
+int progress_start(void)
+{
+	int ret;
+
+	if (!globals.progress && globals.progress_fd < 0)
+		return 0;
+
+	reporter.start = now_ms();
+	reporter.stop = 0;
+
+	ret = pthread_create(&reporter.thread, NULL, progress_thread, NULL);
+	if (ret) {
+		fprintf(stderr, "Could not start progress thread\n");
+		return -ret;
+	}
+
+	reporter.running = 1;
+
+	return 0;
+}
+
+void progress_stop(void)
+{
+	if (!reporter.running)
+		return;
+
+	pthread_mutex_lock(&reporter.lock);
+	reporter.stop = 1;
+	pthread_cond_signal(&reporter.wakeup);
+	pthread_mutex_unlock(&reporter.lock);
+
+	pthread_join(reporter.thread, NULL);
+	reporter.running = 0;
+
+	progress_report(1);
+}
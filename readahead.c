@@ -0,0 +1,239 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* glide64_cache_extract, Glide64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+#define _GNU_SOURCE
+#include "glide64_cache_extract.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Streams which cannot be seeked (pipes, sockets, terminals) are read by
+ * a separate thread into a single-producer/single-consumer ring. The
+ * positions are only exchanged via atomics. The lock is only taken by a
+ * side which has to sleep because the ring is empty or full and by the
+ * other side when it sees the waiting flag.
+ */
+
+#define READAHEAD_SIZE		(16 * 1024 * 1024)
+#define READAHEAD_CHUNK		(1024 * 1024)
+#define READAHEAD_PIPE_SIZE	(1024 * 1024)
+
+static struct {
+	int active;
+	int fd;
+	pthread_t thread;
+	uint8_t *buffer;
+	uint64_t head;
+	uint64_t tail;
+	int eof;
+	int error;
+	int stop;
+	int reader_waiting;
+	int consumer_waiting;
+
+	pthread_mutex_t lock;
+	pthread_cond_t filled;
+	pthread_cond_t drained;
+} reader = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.filled = PTHREAD_COND_INITIALIZER,
+	.drained = PTHREAD_COND_INITIALIZER,
+};
+
+static void readahead_wake(int *waiting, pthread_cond_t *cond)
+{
+	if (!__atomic_load_n(waiting, __ATOMIC_SEQ_CST))
+		return;
+
+	pthread_mutex_lock(&reader.lock);
+	pthread_cond_signal(cond);
+	pthread_mutex_unlock(&reader.lock);
+}
+
+static void *readahead_worker(void *arg __attribute__((unused)))
+{
+	uint64_t head, tail;
+	size_t len;
+	ssize_t ret;
+
+	/* only the blocking read may be interrupted by readahead_stop */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+	tail = reader.tail;
+	while (1) {
+		head = __atomic_load_n(&reader.head, __ATOMIC_ACQUIRE);
+		if (tail - head == READAHEAD_SIZE) {
+			pthread_mutex_lock(&reader.lock);
+			__atomic_store_n(&reader.reader_waiting, 1, __ATOMIC_SEQ_CST);
+			while (!reader.stop &&
+			       tail - __atomic_load_n(&reader.head, __ATOMIC_SEQ_CST) == READAHEAD_SIZE)
+				pthread_cond_wait(&reader.drained, &reader.lock);
+			__atomic_store_n(&reader.reader_waiting, 0, __ATOMIC_RELAXED);
+			pthread_mutex_unlock(&reader.lock);
+
+			if (reader.stop)
+				break;
+			continue;
+		}
+
+		/* contiguous free space up to the end of the ring */
+		len = READAHEAD_SIZE - (tail - head);
+		if (len > READAHEAD_SIZE - tail % READAHEAD_SIZE)
+			len = READAHEAD_SIZE - tail % READAHEAD_SIZE;
+		if (len > READAHEAD_CHUNK)
+			len = READAHEAD_CHUNK;
+
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		ret = read(reader.fd, reader.buffer + tail % READAHEAD_SIZE, len);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret <= 0) {
+			if (ret < 0)
+				__atomic_store_n(&reader.error, 1, __ATOMIC_RELAXED);
+			__atomic_store_n(&reader.eof, 1, __ATOMIC_SEQ_CST);
+			readahead_wake(&reader.consumer_waiting, &reader.filled);
+			break;
+		}
+
+		tail += (uint64_t)ret;
+		__atomic_store_n(&reader.tail, tail, __ATOMIC_SEQ_CST);
+		readahead_wake(&reader.consumer_waiting, &reader.filled);
+	}
+
+	return NULL;
+}
+
+int readahead_start(FILE *in)
+{
+	struct stat st;
+	int ret;
+
+	reader.fd = fileno(in);
+	if (reader.fd < 0 || fstat(reader.fd, &st) < 0 || S_ISREG(st.st_mode))
+		return 0;
+
+#if defined(__linux__)
+	if (S_ISFIFO(st.st_mode))
+		fcntl(reader.fd, F_SETPIPE_SZ, READAHEAD_PIPE_SIZE);
+#endif
+
+	reader.buffer = malloc(READAHEAD_SIZE);
+	if (!reader.buffer) {
+		fprintf(stderr, "Could not allocate memory for read-ahead buffer\n");
+		return -ENOMEM;
+	}
+
+	reader.head = 0;
+	reader.tail = 0;
+	reader.eof = 0;
+	reader.error = 0;
+	reader.stop = 0;
+	reader.reader_waiting = 0;
+	reader.consumer_waiting = 0;
+
+	ret = pthread_create(&reader.thread, NULL, readahead_worker, NULL);
+	if (ret) {
+		fprintf(stderr, "Could not start read-ahead thread\n");
+		free(reader.buffer);
+		reader.buffer = NULL;
+		return -ret;
+	}
+
+	reader.active = 1;
+
+	return 0;
+}
+
+int readahead_active(void)
+{
+	return reader.active;
+}
+
+/* returns less than size only when the stream ended or failed */
+size_t readahead_read(void *buffer, size_t size)
+{
+	uint8_t *pos = buffer;
+	uint64_t head, tail;
+	size_t done = 0;
+	size_t len;
+
+	head = reader.head;
+	while (done < size) {
+		tail = __atomic_load_n(&reader.tail, __ATOMIC_ACQUIRE);
+		if (tail == head) {
+			if (__atomic_load_n(&reader.eof, __ATOMIC_ACQUIRE)) {
+				/* the last data was published before eof */
+				if (__atomic_load_n(&reader.tail, __ATOMIC_ACQUIRE) == head)
+					break;
+				continue;
+			}
+
+			pthread_mutex_lock(&reader.lock);
+			__atomic_store_n(&reader.consumer_waiting, 1, __ATOMIC_SEQ_CST);
+			while (__atomic_load_n(&reader.tail, __ATOMIC_SEQ_CST) == head &&
+			       !__atomic_load_n(&reader.eof, __ATOMIC_SEQ_CST))
+				pthread_cond_wait(&reader.filled, &reader.lock);
+			__atomic_store_n(&reader.consumer_waiting, 0, __ATOMIC_RELAXED);
+			pthread_mutex_unlock(&reader.lock);
+			continue;
+		}
+
+		len = tail - head;
+		if (len > READAHEAD_SIZE - head % READAHEAD_SIZE)
+			len = READAHEAD_SIZE - head % READAHEAD_SIZE;
+		if (len > size - done)
+			len = size - done;
+
+		memcpy(pos + done, reader.buffer + head % READAHEAD_SIZE, len);
+		done += len;
+		head += len;
+
+		__atomic_store_n(&reader.head, head, __ATOMIC_SEQ_CST);
+		readahead_wake(&reader.reader_waiting, &reader.drained);
+	}
+
+	return done;
+}
+
+int readahead_eof(void)
+{
+	return __atomic_load_n(&reader.eof, __ATOMIC_ACQUIRE) &&
+	       __atomic_load_n(&reader.tail, __ATOMIC_ACQUIRE) == reader.head;
+}
+
+int readahead_error(void)
+{
+	return readahead_eof() && __atomic_load_n(&reader.error, __ATOMIC_RELAXED);
+}
+
+void readahead_stop(void)
+{
+	if (!reader.active)
+		return;
+
+	/* the reader might still wait for data which is never needed */
+	pthread_mutex_lock(&reader.lock);
+	reader.stop = 1;
+	pthread_cond_signal(&reader.drained);
+	pthread_mutex_unlock(&reader.lock);
+
+	pthread_cancel(reader.thread);
+	pthread_join(reader.thread, NULL);
+
+	free(reader.buffer);
+	reader.buffer = NULL;
+	reader.active = 0;
+}
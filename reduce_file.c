@@ -0,0 +1,158 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* glide64_cache_extract, Glide64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+#include "glide64_cache_extract.h"
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Opaque ARGB_8888 images can be stored without alpha channel and images
+ * with at most 256 colors with a palette - both without losing any
+ * information.
+ */
+
+#define PALETTE_HASH_MASK	(PALETTE_HASH_SIZE - 1)
+
+static unsigned int palette_hash(uint32_t color)
+{
+	return (color * 2654435761U) >> 23 & PALETTE_HASH_MASK;
+}
+
+#ifdef __SSE2__
+
+int image_opaque(const void *pixels, size_t count)
+{
+	const __m128i ones = _mm_set1_epi8((char)0xff);
+	const uint8_t *pos = pixels;
+	__m128i acc = ones;
+	size_t i = 0;
+
+	for (; i + 4 <= count; i += 4) {
+		acc = _mm_and_si128(acc, _mm_loadu_si128((const __m128i *)&pos[i * 4]));
+
+		/* stop early for the common case of a translucent image */
+		if ((i & 63) == 0 &&
+		    (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, ones)) & 0x8888) != 0x8888)
+			return 0;
+	}
+
+	if ((_mm_movemask_epi8(_mm_cmpeq_epi8(acc, ones)) & 0x8888) != 0x8888)
+		return 0;
+
+	for (; i < count; i++) {
+		if (pos[i * 4 + 3] != 0xff)
+			return 0;
+	}
+
+	return 1;
+}
+
+#else
+
+int image_opaque(const void *pixels, size_t count)
+{
+	const uint8_t *pos = pixels;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		if (pos[i * 4 + 3] != 0xff)
+			return 0;
+	}
+
+	return 1;
+}
+
+#endif
+
+static int palette_add(struct color_palette *palette, uint32_t color)
+{
+	unsigned int slot = palette_hash(color);
+
+	while (palette->used[slot]) {
+		if (palette->keys[slot] == color)
+			return 0;
+
+		slot = (slot + 1) & PALETTE_HASH_MASK;
+	}
+
+	if (palette->count == 256)
+		return -E2BIG;
+
+	palette->used[slot] = 1;
+	palette->keys[slot] = color;
+	palette->index[slot] = (uint8_t)palette->count;
+	palette->colors[palette->count++] = color;
+
+	return 0;
+}
+
+int image_palette(const void *pixels, size_t count, struct color_palette *palette)
+{
+	const uint8_t *pos = pixels;
+	uint32_t color, last;
+	size_t i = 0;
+	int ret;
+
+	memset(palette, 0, sizeof(*palette));
+	if (!count)
+		return 0;
+
+	memcpy(&last, pos, sizeof(last));
+	ret = palette_add(palette, last);
+	if (ret < 0)
+		return ret;
+
+#ifdef __SSE2__
+	/* runs of the previous color are skipped 4 pixels at a time */
+	for (; i + 4 <= count; i += 4) {
+		__m128i block = _mm_loadu_si128((const __m128i *)&pos[i * 4]);
+		__m128i same = _mm_cmpeq_epi32(block, _mm_set1_epi32((int)last));
+		size_t j;
+
+		if (_mm_movemask_epi8(same) == 0xffff)
+			continue;
+
+		for (j = i; j < i + 4; j++) {
+			memcpy(&color, &pos[j * 4], sizeof(color));
+			if (color == last)
+				continue;
+
+			ret = palette_add(palette, color);
+			if (ret < 0)
+				return ret;
+			last = color;
+		}
+	}
+#endif
+
+	for (; i < count; i++) {
+		memcpy(&color, &pos[i * 4], sizeof(color));
+		if (color == last)
+			continue;
+
+		ret = palette_add(palette, color);
+		if (ret < 0)
+			return ret;
+		last = color;
+	}
+
+	return 0;
+}
+
+uint8_t palette_index(const struct color_palette *palette, uint32_t color)
+{
+	unsigned int slot = palette_hash(color);
+
+	while (!palette->used[slot] || palette->keys[slot] != color)
+		slot = (slot + 1) & PALETTE_HASH_MASK;
+
+	return palette->index[slot];
+}
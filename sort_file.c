@@ -0,0 +1,225 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* glide64_cache_extract, Glide64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+#include "glide64_cache_extract.h"
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+struct sort_entry {
+	uint64_t offset;
+	uint64_t checksum;
+	uint32_t width;
+	uint32_t height;
+	uint32_t size;
+	uint16_t format;
+};
+
+static const struct {
+	const char *name;
+	enum sort_key key;
+} sort_key_names[] = {
+	{ "format", SORT_FORMAT },
+	{ "width", SORT_WIDTH },
+	{ "height", SORT_HEIGHT },
+	{ "checksum", SORT_CHECKSUM },
+	{ "size", SORT_SIZE },
+	{ "offset", SORT_OFFSET },
+};
+
+static int add_sort_key(enum sort_key key)
+{
+	if (globals.sort_keys_count >= MAX_SORT_KEYS) {
+		fprintf(stderr, "Too many sort keys\n");
+		return -EINVAL;
+	}
+
+	globals.sort_keys[globals.sort_keys_count++] = key;
+
+	return 0;
+}
+
+int parse_sort_keys(const char *keys)
+{
+	char *list, *key, *saveptr;
+	size_t i;
+	int ret = 0;
+
+	list = strdup(keys);
+	if (!list)
+		return -ENOMEM;
+
+	globals.sort_keys_count = 0;
+	for (key = strtok_r(list, ",", &saveptr); key && ret >= 0;
+	     key = strtok_r(NULL, ",", &saveptr)) {
+		if (strcasecmp(key, "default") == 0) {
+			ret = add_sort_key(SORT_FORMAT);
+			if (ret >= 0)
+				ret = add_sort_key(SORT_WIDTH);
+			if (ret >= 0)
+				ret = add_sort_key(SORT_HEIGHT);
+			if (ret >= 0)
+				ret = add_sort_key(SORT_CHECKSUM);
+			continue;
+		}
+
+		if (strcasecmp(key, "dimensions") == 0) {
+			ret = add_sort_key(SORT_WIDTH);
+			if (ret >= 0)
+				ret = add_sort_key(SORT_HEIGHT);
+			continue;
+		}
+
+		for (i = 0; i < sizeof(sort_key_names) / sizeof(sort_key_names[0]); i++) {
+			if (strcasecmp(key, sort_key_names[i].name) == 0)
+				break;
+		}
+
+		if (i == sizeof(sort_key_names) / sizeof(sort_key_names[0])) {
+			fprintf(stderr, "Invalid sort key %s\n", key);
+			ret = -EINVAL;
+			break;
+		}
+
+		ret = add_sort_key(sort_key_names[i].key);
+	}
+
+	free(list);
+
+	if (ret >= 0 && !globals.sort_keys_count) {
+		fprintf(stderr, "No sort key given\n");
+		ret = -EINVAL;
+	}
+
+	return ret;
+}
+
+#define COMPARE(a, b) \
+	do { \
+		if ((a) < (b)) \
+			return -1; \
+		if ((a) > (b)) \
+			return 1; \
+	} while (0)
+
+static int compare_entry(const void *a, const void *b)
+{
+	const struct sort_entry *entry_a = a;
+	const struct sort_entry *entry_b = b;
+	unsigned int i;
+
+	for (i = 0; i < globals.sort_keys_count; i++) {
+		switch (globals.sort_keys[i]) {
+		case SORT_FORMAT:
+			COMPARE(entry_a->format & ~GR_TEXFMT_GZ, entry_b->format & ~GR_TEXFMT_GZ);
+			break;
+		case SORT_WIDTH:
+			COMPARE(entry_a->width, entry_b->width);
+			break;
+		case SORT_HEIGHT:
+			COMPARE(entry_a->height, entry_b->height);
+			break;
+		case SORT_CHECKSUM:
+			COMPARE(entry_a->checksum, entry_b->checksum);
+			break;
+		case SORT_SIZE:
+			COMPARE(entry_a->size, entry_b->size);
+			break;
+		case SORT_OFFSET:
+			COMPARE(entry_a->offset, entry_b->offset);
+			break;
+		}
+	}
+
+	/* keep the cache order for equal entries */
+	COMPARE(entry_a->offset, entry_b->offset);
+
+	return 0;
+}
+
+#undef COMPARE
+
+/* first pass only reads the headers, the second reads the payloads in the
+ * order of the sorted plan. Input progress is only counted by the second pass
+ */
+int convert_sorted(void)
+{
+	struct sort_entry *entries = NULL, *tmp;
+	struct glide64_file file;
+	size_t count = 0, alloc = 0, i;
+	uint64_t base;
+	off_t start;
+	struct stat st;
+	int ret;
+
+	start = ftello(globals.in);
+	if (start < 0 || fstat(fileno(globals.in), &st) < 0 || !S_ISREG(st.st_mode)) {
+		fprintf(stderr, "Sorted output requires a seekable input file\n");
+		return -EINVAL;
+	}
+	base = globals.in_offset;
+
+	while (1) {
+		ret = read_file_header(&file);
+		if (ret > 0)
+			break;
+		if (ret < 0)
+			goto out;
+		progress_sub(&progress.bytes_in, globals.in_offset - file.offset);
+
+		if (count == alloc) {
+			alloc = alloc ? alloc * 2 : 1024;
+			tmp = realloc(entries, alloc * sizeof(*entries));
+			if (!tmp) {
+				fprintf(stderr, "Could not allocate memory for sort plan\n");
+				ret = -ENOMEM;
+				goto out;
+			}
+			entries = tmp;
+		}
+
+		entries[count].offset = file.offset;
+		entries[count].checksum = file.checksum;
+		entries[count].width = file.width;
+		entries[count].height = file.height;
+		entries[count].size = file.size;
+		entries[count].format = file.format;
+		count++;
+
+		if (fseeko(globals.in, file.size, SEEK_CUR) < 0) {
+			ret = -EIO;
+			goto out;
+		}
+		globals.in_offset += file.size;
+	}
+
+	qsort(entries, count, sizeof(*entries), compare_entry);
+
+	for (i = 0; i < count; i++) {
+		if (fseeko(globals.in, start + (off_t)(entries[i].offset - base), SEEK_SET) < 0) {
+			fprintf(stderr, "Could not seek to record\n");
+			ret = -EIO;
+			goto out;
+		}
+		globals.in_offset = entries[i].offset;
+
+		ret = convert_file();
+		if (ret < 0)
+			goto out;
+	}
+
+	ret = 0;
+
+out:
+	free(entries);
+	return ret;
+}
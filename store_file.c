@@ -0,0 +1,530 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* glide64_cache_extract, Glide64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+#include "glide64_cache_extract.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/* Converted textures are written once to STORE/xx/HASH.ext, named after the
+ * SHA-256 of their content. The tar only contains symbolic links to them.
+ * STORE/index maps the record headers, the crc of the cached payload and the
+ * options which change the converted content to these names. Known records
+ * are not inflated and converted again as long as their file still exists in
+ * the store.
+ */
+
+#define STORE_BUCKETS	65536
+#define STORE_INDEX	"index"
+
+struct store_entry {
+	struct store_entry *next;
+	uint64_t checksum;
+	uint32_t cache_size;
+	uint32_t cache_crc;
+	uint16_t cache_format;
+	char name[STORE_NAME_LEN];
+};
+
+static struct {
+	char *dir;
+	FILE *index;
+	uint32_t variant;
+	struct store_entry *buckets[STORE_BUCKETS];
+	uint64_t written;
+	uint64_t linked;
+	uint64_t skipped;
+} store;
+
+struct sha256 {
+	uint32_t state[8];
+	uint64_t length;
+	uint8_t block[64];
+};
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+	0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+	0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+	0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+	0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+	0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static uint32_t ror32(uint32_t value, unsigned int shift)
+{
+	return value >> shift | value << (32 - shift);
+}
+
+static void sha256_block(struct sha256 *ctx, const uint8_t *block)
+{
+	uint32_t w[64];
+	uint32_t s[8];
+	uint32_t t1, t2;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+		       (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+
+	for (i = 16; i < 64; i++)
+		w[i] = w[i - 16] + w[i - 7] +
+		       (ror32(w[i - 15], 7) ^ ror32(w[i - 15], 18) ^ w[i - 15] >> 3) +
+		       (ror32(w[i - 2], 17) ^ ror32(w[i - 2], 19) ^ w[i - 2] >> 10);
+
+	memcpy(s, ctx->state, sizeof(s));
+	for (i = 0; i < 64; i++) {
+		t1 = s[7] + (ror32(s[4], 6) ^ ror32(s[4], 11) ^ ror32(s[4], 25)) +
+		     ((s[4] & s[5]) ^ (~s[4] & s[6])) + sha256_k[i] + w[i];
+		t2 = (ror32(s[0], 2) ^ ror32(s[0], 13) ^ ror32(s[0], 22)) +
+		     ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+
+		memmove(&s[1], &s[0], sizeof(s[0]) * 7);
+		s[4] += t1;
+		s[0] = t1 + t2;
+	}
+
+	for (i = 0; i < 8; i++)
+		ctx->state[i] += s[i];
+}
+
+static void sha256(const void *data, size_t size, uint8_t digest[32])
+{
+	static const uint32_t init[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+	const uint8_t *pos = data;
+	struct sha256 ctx;
+	size_t rest;
+	int i;
+
+	memcpy(ctx.state, init, sizeof(ctx.state));
+	ctx.length = (uint64_t)size * 8;
+
+	for (; size >= sizeof(ctx.block); size -= sizeof(ctx.block)) {
+		sha256_block(&ctx, pos);
+		pos += sizeof(ctx.block);
+	}
+
+	/* padding with 0x80, zeros and the length in bits */
+	memset(ctx.block, 0, sizeof(ctx.block));
+	memcpy(ctx.block, pos, size);
+	ctx.block[size] = 0x80;
+	rest = size + 1;
+	if (rest > sizeof(ctx.block) - 8) {
+		sha256_block(&ctx, ctx.block);
+		memset(ctx.block, 0, sizeof(ctx.block));
+	}
+
+	for (i = 0; i < 8; i++)
+		ctx.block[56 + i] = (uint8_t)(ctx.length >> (56 - i * 8));
+	sha256_block(&ctx, ctx.block);
+
+	for (i = 0; i < 32; i++)
+		digest[i] = (uint8_t)(ctx.state[i / 4] >> (24 - (i % 4) * 8));
+}
+
+/* all options which change the content of a converted texture */
+static uint32_t store_variant(void)
+{
+	return (uint32_t)globals.bitmapv5 |
+	       (uint32_t)globals.untile << 1 |
+	       (uint32_t)globals.native << 2 |
+	       (uint32_t)globals.top_down << 3 |
+	       (uint32_t)globals.reduce << 4 |
+	       (uint32_t)globals.encode << 5;
+}
+
+static unsigned int store_bucket(uint64_t checksum)
+{
+	return (unsigned int)((checksum * 0x9e3779b97f4a7c15ULL) >> 48);
+}
+
+static struct store_entry *store_find(const struct glide64_file *file)
+{
+	struct store_entry *entry;
+
+	entry = store.buckets[store_bucket(file->checksum)];
+	for (; entry; entry = entry->next) {
+		if (entry->checksum == file->checksum &&
+		    entry->cache_format == file->cache_format &&
+		    entry->cache_size == file->cache_size &&
+		    entry->cache_crc == file->cache_crc)
+			return entry;
+	}
+
+	return NULL;
+}
+
+static int store_insert(const struct glide64_file *file, const char *name)
+{
+	struct store_entry *entry;
+	unsigned int bucket;
+
+	entry = store_find(file);
+	if (!entry) {
+		entry = calloc(1, sizeof(*entry));
+		if (!entry) {
+			fprintf(stderr, "Could not allocate memory for store index\n");
+			return -ENOMEM;
+		}
+
+		entry->checksum = file->checksum;
+		entry->cache_format = file->cache_format;
+		entry->cache_size = file->cache_size;
+		entry->cache_crc = file->cache_crc;
+
+		bucket = store_bucket(file->checksum);
+		entry->next = store.buckets[bucket];
+		store.buckets[bucket] = entry;
+	}
+
+	snprintf(entry->name, sizeof(entry->name), "%s", name);
+
+	return 0;
+}
+
+static int store_load(const char *path)
+{
+	struct glide64_file file;
+	char name[STORE_NAME_LEN];
+	uint32_t variant;
+	FILE *f;
+	int ret;
+
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+
+	memset(&file, 0, sizeof(file));
+	while (1) {
+		ret = fscanf(f, "%"SCNx64" %"SCNx16" %"SCNx32" %"SCNx32" %"SCNx32" %39s\n",
+			     &file.checksum, &file.cache_format, &file.cache_size,
+			     &file.cache_crc, &variant, name);
+		if (ret == EOF)
+			break;
+
+		if (ret != 6) {
+			fprintf(stderr, "Invalid store index %s\n", path);
+			fclose(f);
+			return -EINVAL;
+		}
+
+		/* entries of other options describe different files */
+		if (variant != store.variant)
+			continue;
+
+		ret = store_insert(&file, name);
+		if (ret < 0) {
+			fclose(f);
+			return ret;
+		}
+	}
+
+	fclose(f);
+
+	return 0;
+}
+
+static char *store_path(const char *name)
+{
+	size_t len = strlen(store.dir) + 1 + strlen(name) + 1;
+	char *path;
+
+	path = malloc(len);
+	if (!path)
+		return NULL;
+
+	snprintf(path, len, "%s/%s", store.dir, name);
+
+	return path;
+}
+
+int store_open(const char *dir)
+{
+	char resolved[PATH_MAX];
+	char *path;
+	int ret;
+
+	if (mkdir(dir, 0777) < 0 && errno != EEXIST) {
+		fprintf(stderr, "Could not create store directory %s\n", dir);
+		return -EIO;
+	}
+
+	if (!realpath(dir, resolved)) {
+		fprintf(stderr, "Could not resolve store directory %s\n", dir);
+		return -ENOENT;
+	}
+
+	/* the links have to fit into the linkname of the tar header */
+	if (strlen(resolved) + 1 + STORE_NAME_LEN > sizeof(((struct tar_header *)0)->linkname)) {
+		fprintf(stderr, "Store directory %s is too long for tar symbolic links\n",
+			resolved);
+		return -ENAMETOOLONG;
+	}
+
+	store.dir = strdup(resolved);
+	if (!store.dir) {
+		fprintf(stderr, "Could not save store directory\n");
+		return -ENOMEM;
+	}
+
+	store.variant = store_variant();
+
+	path = store_path(STORE_INDEX);
+	if (!path) {
+		fprintf(stderr, "Could not allocate store index path\n");
+		return -ENOMEM;
+	}
+
+	ret = store_load(path);
+	if (ret < 0) {
+		free(path);
+		return ret;
+	}
+
+	store.index = fopen(path, "a");
+	free(path);
+	if (!store.index) {
+		fprintf(stderr, "Could not open store index\n");
+		return -EIO;
+	}
+
+	/* lines of concurrent runs must not be interleaved */
+	setvbuf(store.index, NULL, _IOLBF, 0);
+
+	return 0;
+}
+
+static int store_exists(const char *name)
+{
+	struct stat st;
+	char *path;
+	int ret;
+
+	path = store_path(name);
+	if (!path)
+		return 0;
+
+	ret = stat(path, &st) == 0 && S_ISREG(st.st_mode);
+	free(path);
+
+	return ret;
+}
+
+/* the reader only picks the newest blob of the same record from the index,
+ * the worker compares the crc of the payload in store_check()
+ */
+void store_lookup(struct glide64_file *file)
+{
+	struct store_entry *entry;
+
+	if (!store.dir)
+		return;
+
+	entry = store.buckets[store_bucket(file->checksum)];
+	for (; entry; entry = entry->next) {
+		if (entry->checksum == file->checksum &&
+		    entry->cache_format == file->cache_format &&
+		    entry->cache_size == file->cache_size)
+			break;
+	}
+
+	if (!entry)
+		return;
+
+	file->store_crc = entry->cache_crc;
+	snprintf(file->store_name, sizeof(file->store_name), "%s", entry->name);
+}
+
+int store_check(struct glide64_file *file)
+{
+	if (!store.dir)
+		return 0;
+
+	/* the checksum only identifies the original texture and not the
+	 * replacement of a specific hires pack
+	 */
+	file->cache_crc = (uint32_t)crc32(crc32(0L, Z_NULL, 0), file->data, file->size);
+
+	if (!file->store_name[0] || file->store_crc != file->cache_crc ||
+	    !store_exists(file->store_name))
+		return 0;
+
+	free(file->data);
+	file->data = NULL;
+	file->store_hit = 1;
+
+	/* the name of the link is created like for an inflated payload */
+	file->format &= ~GR_TEXFMT_GZ;
+
+	return 1;
+}
+
+int store_hash(struct glide64_file *file)
+{
+	uint8_t digest[32];
+	char name[100];
+	const char *ext;
+	char *pos;
+	size_t i;
+
+	sha256(file->data, file->size, digest);
+
+	file_name(file, name, sizeof(name));
+	ext = strrchr(name, '.');
+	if (!ext)
+		ext = "";
+
+	/* 128 bit of the digest are enough to name the files */
+	pos = file->store_name;
+	for (i = 0; i < 16; i++) {
+		pos += sprintf(pos, "%02x", digest[i]);
+		if (i == 0)
+			*pos++ = '/';
+	}
+	snprintf(pos, sizeof(file->store_name) - (size_t)(pos - file->store_name),
+		 "%.4s", ext);
+
+	return 0;
+}
+
+static int store_put(const struct glide64_file *file, const char *path)
+{
+	char *tmppath;
+	char *slash;
+	size_t len;
+	FILE *f;
+	int ret = 0;
+
+	len = strlen(path) + 32;
+	tmppath = malloc(len);
+	if (!tmppath)
+		return -ENOMEM;
+
+	snprintf(tmppath, len, "%s", path);
+	slash = strrchr(tmppath, '/');
+	*slash = '\0';
+	if (mkdir(tmppath, 0777) < 0 && errno != EEXIST) {
+		fprintf(stderr, "Could not create store directory %s\n", tmppath);
+		free(tmppath);
+		return -EIO;
+	}
+
+	/* other runs may store the same file at the same time */
+	snprintf(tmppath, len, "%s.%ld.tmp", path, (long)getpid());
+	f = fopen(tmppath, "wb");
+	if (!f) {
+		fprintf(stderr, "Could not create store file %s\n", tmppath);
+		free(tmppath);
+		return -EIO;
+	}
+
+	if (fwrite(file->data, 1, file->size, f) != file->size)
+		ret = -EIO;
+	if (fclose(f) != 0)
+		ret = -EIO;
+	if (ret == 0 && rename(tmppath, path) < 0)
+		ret = -EIO;
+
+	if (ret < 0) {
+		fprintf(stderr, "Could not write store file %s\n", path);
+		unlink(tmppath);
+	}
+
+	free(tmppath);
+
+	return ret;
+}
+
+int store_write_file(struct glide64_file *file)
+{
+	char name[100];
+	char *path;
+	int ret = 0;
+
+	path = store_path(file->store_name);
+	if (!path) {
+		fprintf(stderr, "Could not allocate store path\n");
+		return -ENOMEM;
+	}
+
+	if (file->store_hit) {
+		store.skipped++;
+	} else if (store_exists(file->store_name)) {
+		store.linked++;
+	} else {
+		ret = store_put(file, path);
+		store.written++;
+	}
+
+	if (ret == 0 && !file->store_hit) {
+		ret = store_insert(file, file->store_name);
+		if (ret == 0 &&
+		    fprintf(store.index, "%016"PRIX64" %04"PRIx16" %08"PRIx32" %08"PRIx32" %02"PRIx32" %s\n",
+			    file->checksum, file->cache_format, file->cache_size,
+			    file->cache_crc, store.variant,
+			    file->store_name) < 0) {
+			fprintf(stderr, "Could not write store index\n");
+			ret = -EIO;
+		}
+	}
+
+	if (ret == 0) {
+		file_name(file, name, sizeof(name));
+		ret = write_tar_link(name, path);
+	}
+
+	free(path);
+
+	return ret;
+}
+
+int store_close(void)
+{
+	struct store_entry *entry, *next;
+	unsigned int i;
+	int ret = 0;
+
+	if (!store.dir)
+		return 0;
+
+	if (store.index && fclose(store.index) != 0) {
+		fprintf(stderr, "Could not write store index\n");
+		ret = -EIO;
+	}
+
+	if (globals.verbose >= VERBOSITY_GLOBAL_HEADER)
+		fprintf(stderr, "Store: %"PRIu64" new, %"PRIu64" already stored, %"PRIu64" not converted again\n",
+			store.written, store.linked, store.skipped);
+
+	for (i = 0; i < STORE_BUCKETS; i++) {
+		for (entry = store.buckets[i]; entry; entry = next) {
+			next = entry->next;
+			free(entry);
+		}
+	}
+
+	free(store.dir);
+	memset(&store, 0, sizeof(store));
+
+	return ret;
+}
@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: GPL-3.0-or-later
+# SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+#
+# Write an uncompressed Glide64 cache with generated texture records
+#
+#   mkcache.py OUT FORMAT:WIDTHxHEIGHT[:gz] [...]
+
+import struct
+import sys
+import zlib
+
+CONFIG = 0x04810000
+
+FORMATS = {
+    'ARGB_8888': (0x12, 32),
+    'RGB_565': (0x0a, 16),
+    'ARGB_4444': (0x0c, 16),
+    'ALPHA_8': (0x02, 8),
+    'DXT1': (0x16, None),
+    'DXT3': (0x18, None),
+    'DXT5': (0x1a, None),
+}
+
+GR_TEXFMT_GZ = 0x8000
+
+
+def payload_size(name, width, height):
+    fmt, bpp = FORMATS[name]
+
+    # GlideHQ TxUtil::sizeofTx: 8 bytes per 4x4 block for DXT1, 16 for DXT3/5
+    if bpp is None:
+        blocks = ((width + 3) // 4) * ((height + 3) // 4)
+        return blocks * (8 if name == 'DXT1' else 16)
+
+    return width * height * bpp // 8
+
+
+def record(index, spec):
+    parts = spec.split(':')
+    name = parts[0]
+    width, height = (int(v) for v in parts[1].split('x'))
+    gz = len(parts) > 2 and parts[2] == 'gz'
+
+    size = payload_size(name, width, height)
+    data = bytes((index * 31 + i * 7) & 0xff for i in range(size))
+    fmt = FORMATS[name][0]
+    if gz:
+        data = zlib.compress(data)
+        fmt |= GR_TEXFMT_GZ
+
+    checksum = 0x0123456789ab0000 + index
+    header = struct.pack('<QIIHIIIIIIBI', checksum, width, height, fmt,
+                         0, 0, 0, 0, width, height, 1, len(data))
+
+    return header + data
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.stderr.write('Usage: %s OUT FORMAT:WIDTHxHEIGHT[:gz] ...\n' % sys.argv[0])
+        return 1
+
+    with open(sys.argv[1], 'wb') as out:
+        out.write(struct.pack('<I', CONFIG))
+        for index, spec in enumerate(sys.argv[2:]):
+            out.write(record(index, spec))
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
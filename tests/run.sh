@@ -0,0 +1,35 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-3.0-or-later
+# SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+#
+# Run each tests/test_*.sh in its own temporary directory
+#
+#   run.sh BINARY
+
+if [ "$#" -ne 1 ]; then
+	echo "Usage: $0 BINARY" >&2
+	exit 1
+fi
+
+TESTS=$(cd "$(dirname "$0")" && pwd)
+G64=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+MKCACHE="python3 ${TESTS}/mkcache.py"
+export G64 MKCACHE
+
+failed=0
+for test in "${TESTS}"/test_*.sh; do
+	name=$(basename "${test}" .sh)
+	dir=$(mktemp -d)
+
+	if (cd "${dir}" && sh -e "${test}") > "${dir}.log" 2>&1; then
+		echo "PASS ${name}"
+	else
+		echo "FAIL ${name}"
+		cat "${dir}.log"
+		failed=$((failed + 1))
+	fi
+
+	rm -rf "${dir}" "${dir}.log"
+done
+
+[ "${failed}" -eq 0 ]
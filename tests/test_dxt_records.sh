@@ -0,0 +1,43 @@
+# SPDX-License-Identifier: GPL-3.0-or-later
+# SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+#
+# DXT records use 8 (DXT1) or 16 (DXT3/DXT5) bytes per 4x4 block
+
+${MKCACHE} dxt.dat DXT1:8x8 DXT5:8x8 DXT1:6x10:gz DXT5:30x2:gz DXT3:4x4
+
+"${G64}" -V -i dxt.dat
+"${G64}" -i dxt.dat -o dxt.tar
+
+python3 - dxt.dat dxt.tar <<EOF
+import struct
+import sys
+import tarfile
+import zlib
+
+payloads = []
+with open(sys.argv[1], 'rb') as cache:
+    data = cache.read()
+
+pos = 4
+while pos < len(data):
+    fmt = struct.unpack_from('<H', data, pos + 16)[0]
+    size = struct.unpack_from('<I', data, pos + 43)[0]
+    payload = data[pos + 47:pos + 47 + size]
+    if fmt & 0x8000:
+        payload = zlib.decompress(payload)
+    payloads.append(payload)
+    pos += 47 + size
+
+assert [len(p) for p in payloads] == [32, 64, 48, 128, 16]
+
+with tarfile.open(sys.argv[2]) as tar:
+    members = [m for m in tar.getmembers() if m.isfile()]
+    assert len(members) == len(payloads), [m.name for m in members]
+
+    for member, payload in zip(members, payloads):
+        assert member.name.endswith('.dds'), member.name
+        content = tar.extractfile(member).read()
+        assert content[:4] == b'DDS ', member.name
+        assert content[-len(payload):] == payload, member.name
+        assert len(content) == 128 + len(payload), member.name
+EOF
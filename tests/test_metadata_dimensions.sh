@@ -0,0 +1,22 @@
+# SPDX-License-Identifier: GPL-3.0-or-later
+# SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+#
+# the metadata keeps the dimensions of the record when the texture is resized
+
+${MKCACHE} in.dat ARGB_8888:32x16 RGB_565:8x8
+
+"${G64}" -i in.dat -o sheet.tar -S 8 -m sheet.json
+"${G64}" -i in.dat -o plain.tar -m plain.json
+
+python3 - sheet.json plain.json <<EOF
+import json
+import sys
+
+for path, thumbnail in zip(sys.argv[1:], ([(8, 4), (8, 8)], None)):
+    with open(path) as metadata:
+        files = [r for r in map(json.loads, metadata) if r['type'] == 'file']
+
+    assert [(f['width'], f['height']) for f in files] == [(32, 16), (8, 8)], files
+    output = [(f['output_width'], f['output_height']) for f in files]
+    assert output == (thumbnail or [(32, 16), (8, 8)]), output
+EOF
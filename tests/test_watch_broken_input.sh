@@ -0,0 +1,23 @@
+# SPDX-License-Identifier: GPL-3.0-or-later
+# SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+#
+# a truncated cache must not leave its zip entries to the next output
+
+mkdir in out
+${MKCACHE} good.dat ARGB_8888:16x16 RGB_565:8x8:gz DXT1:8x8 ARGB_8888:32x32
+head -c 3000 good.dat > in/a_broken.dat
+cp good.dat in/b_good.dat
+
+ret=0
+timeout 2 "${G64}" -z store -O out -w in || ret=$?
+[ "${ret}" -eq 124 ]
+
+[ ! -e out/a_broken.zip ]
+python3 - out/b_good.zip <<EOF
+import sys
+import zipfile
+
+with zipfile.ZipFile(sys.argv[1]) as z:
+    assert z.testzip() is None
+    assert len(z.namelist()) == 4, z.namelist()
+EOF
@@ -0,0 +1,214 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* glide64_cache_extract, Glide64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+#include "glide64_cache_extract.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Each thread appends its events to its own list of chunks. The chunks are
+ * only written as Chrome trace-event JSON when the trace is closed and all
+ * threads were stopped.
+ */
+
+#define TRACE_CHUNK_EVENTS	4096
+
+struct trace_event {
+	const char *name;
+	uint64_t start;
+	uint64_t end;
+	uint64_t checksum;
+	uint32_t size;
+	uint16_t format;
+};
+
+struct trace_chunk {
+	struct trace_chunk *next;
+	size_t count;
+	struct trace_event events[TRACE_CHUNK_EVENTS];
+};
+
+struct trace_thread {
+	struct trace_thread *next;
+	struct trace_chunk *head;
+	struct trace_chunk *tail;
+	unsigned int tid;
+	int main;
+};
+
+int trace_enabled;
+
+static struct {
+	FILE *out;
+	uint64_t epoch;
+	pthread_t main;
+	pthread_mutex_t lock;
+	struct trace_thread *threads;
+	unsigned int count;
+} trace = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static __thread struct trace_thread *trace_current;
+
+uint64_t trace_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+int trace_open(const char *path)
+{
+	trace.out = fopen(path, "w");
+	if (!trace.out) {
+		fprintf(stderr, "Could not open trace file %s\n", path);
+		return -ENOENT;
+	}
+
+	trace.epoch = trace_clock();
+	trace.main = pthread_self();
+	trace_enabled = 1;
+
+	return 0;
+}
+
+static struct trace_thread *trace_thread_get(void)
+{
+	struct trace_thread *thread;
+
+	if (trace_current)
+		return trace_current;
+
+	thread = calloc(1, sizeof(*thread));
+	if (!thread)
+		return NULL;
+
+	thread->main = pthread_equal(pthread_self(), trace.main);
+
+	pthread_mutex_lock(&trace.lock);
+	thread->tid = ++trace.count;
+	thread->next = trace.threads;
+	trace.threads = thread;
+	pthread_mutex_unlock(&trace.lock);
+
+	trace_current = thread;
+
+	return thread;
+}
+
+void trace_record(const struct glide64_file *file, const char *name,
+		  uint64_t start)
+{
+	struct trace_thread *thread;
+	struct trace_chunk *chunk;
+	struct trace_event *event;
+
+	thread = trace_thread_get();
+	if (!thread)
+		return;
+
+	chunk = thread->tail;
+	if (!chunk || chunk->count == TRACE_CHUNK_EVENTS) {
+		chunk = malloc(sizeof(*chunk));
+		if (!chunk)
+			return;
+
+		chunk->next = NULL;
+		chunk->count = 0;
+		if (thread->tail)
+			thread->tail->next = chunk;
+		else
+			thread->head = chunk;
+		thread->tail = chunk;
+	}
+
+	event = &chunk->events[chunk->count++];
+	event->name = name;
+	event->start = start;
+	event->end = trace_clock();
+	event->checksum = file->checksum;
+	event->size = file->cache_size;
+	event->format = file->cache_format;
+}
+
+static void trace_timestamp(const char *key, uint64_t ns)
+{
+	fprintf(trace.out, ",\"%s\":%"PRIu64".%03"PRIu64, key, ns / 1000, ns % 1000);
+}
+
+static void trace_write_event(const struct trace_thread *thread,
+			      const struct trace_event *event, int *first)
+{
+	const struct texture_format *fmt;
+	uint64_t start = event->start - trace.epoch;
+
+	fmt = texture_format_get(event->format & ~GR_TEXFMT_GZ);
+
+	fprintf(trace.out, "%s\n{\"name\":\"%s\",\"cat\":\"record\",\"ph\":\"X\",\"pid\":1,\"tid\":%u",
+		*first ? "" : ",", event->name, thread->tid);
+	trace_timestamp("ts", start);
+	trace_timestamp("dur", event->end - event->start);
+	fprintf(trace.out, ",\"args\":{\"checksum\":\"%016"PRIX64"\",\"format\":\"%s%s\",\"size\":%"PRIu32"}}",
+		event->checksum, fmt ? fmt->name : "unknown",
+		event->format & GR_TEXFMT_GZ ? "+gz" : "", event->size);
+	*first = 0;
+}
+
+int trace_close(void)
+{
+	struct trace_thread *thread, *next_thread;
+	struct trace_chunk *chunk, *next_chunk;
+	int first = 1;
+	size_t i;
+	int ret = 0;
+
+	if (!trace.out)
+		return 0;
+
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", trace.out);
+
+	for (thread = trace.threads; thread; thread = next_thread) {
+		next_thread = thread->next;
+
+		fprintf(trace.out, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s %u\"}}",
+			first ? "" : ",", thread->tid,
+			thread->main ? "reader" : "worker", thread->tid);
+		first = 0;
+
+		for (chunk = thread->head; chunk; chunk = next_chunk) {
+			next_chunk = chunk->next;
+
+			for (i = 0; i < chunk->count; i++)
+				trace_write_event(thread, &chunk->events[i], &first);
+
+			free(chunk);
+		}
+
+		free(thread);
+	}
+
+	fputs("\n]}\n", trace.out);
+
+	if (fclose(trace.out) != 0) {
+		fprintf(stderr, "Could not write trace file\n");
+		ret = -EIO;
+	}
+
+	trace.out = NULL;
+	trace.threads = NULL;
+	trace_enabled = 0;
+	trace_current = NULL;
+
+	return ret;
+}
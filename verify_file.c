@@ -0,0 +1,127 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* glide64_cache_extract, Glide64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+#include "glide64_cache_extract.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+enum verify_error {
+	VERIFY_OK = 0,
+	VERIFY_FORMAT = -1,
+	VERIFY_SIZE = -2,
+	VERIFY_INFLATE = -3,
+	VERIFY_INFLATE_SIZE = -4,
+	VERIFY_TRUNCATED = -5,
+};
+
+static const char *verify_errors[] = {
+	[-VERIFY_OK] = "ok",
+	[-VERIFY_FORMAT] = "unsupported format",
+	[-VERIFY_SIZE] = "size doesn't match the texture dimensions",
+	[-VERIFY_INFLATE] = "failure during decompressing",
+	[-VERIFY_INFLATE_SIZE] = "decompressed content has wrong size",
+	[-VERIFY_TRUNCATED] = "record is incomplete",
+};
+
+static uint64_t verified;
+static uint64_t bad;
+
+static int verify_inflate(const struct glide64_file *file, size_t expected)
+{
+	uint8_t chunk[16384];
+	z_stream strm;
+	size_t total = 0;
+	int ret;
+
+	memset(&strm, 0, sizeof(strm));
+	if (inflateInit(&strm) != Z_OK)
+		return VERIFY_INFLATE;
+
+	strm.next_in = file->data;
+	strm.avail_in = file->size;
+
+	do {
+		strm.next_out = chunk;
+		strm.avail_out = sizeof(chunk);
+
+		ret = inflate(&strm, Z_NO_FLUSH);
+		if (ret != Z_OK && ret != Z_STREAM_END)
+			break;
+
+		total += sizeof(chunk) - strm.avail_out;
+		if (total > expected)
+			break;
+	} while (ret != Z_STREAM_END);
+
+	inflateEnd(&strm);
+
+	if (ret != Z_STREAM_END && total <= expected)
+		return VERIFY_INFLATE;
+
+	if (total != expected)
+		return VERIFY_INFLATE_SIZE;
+
+	return VERIFY_OK;
+}
+
+int verify_file(struct glide64_file *file)
+{
+	size_t expected_size;
+
+	if (!texture_format_get(file->format & ~GR_TEXFMT_GZ))
+		return VERIFY_FORMAT;
+
+	expected_size = image_content_length(file);
+	if (!expected_size || expected_size > UINT32_MAX || !file->size)
+		return VERIFY_SIZE;
+
+	if (file->format & GR_TEXFMT_GZ)
+		return verify_inflate(file, expected_size);
+
+	if (expected_size != file->size)
+		return VERIFY_SIZE;
+
+	return VERIFY_OK;
+}
+
+int verify_finish(struct glide64_file *file, int status)
+{
+	free(file->data);
+	file->data = NULL;
+
+	verified++;
+	metadata_file(file, NULL, verify_errors[-status]);
+	if (status == VERIFY_OK)
+		return 0;
+
+	bad++;
+	fprintf(stderr, "%s: offset %#"PRIx64": checksum 0x%016"PRIX64": format %#"PRIx16": %s\n",
+		file->prefix ? file->prefix : "input", file->offset, file->checksum,
+		file->format, verify_errors[-status]);
+
+	return 0;
+}
+
+void verify_truncated(uint64_t offset)
+{
+	bad++;
+	fprintf(stderr, "%s: offset %#"PRIx64": %s\n",
+		globals.prefix ? globals.prefix : "input", offset,
+		verify_errors[-VERIFY_TRUNCATED]);
+}
+
+int verify_summary(void)
+{
+	fprintf(stderr, "Verified %"PRIu64" records, %"PRIu64" bad\n", verified, bad);
+
+	return bad ? -EINVAL : 0;
+}
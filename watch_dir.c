@@ -0,0 +1,293 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* glide64_cache_extract, Glide64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+#include "glide64_cache_extract.h"
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+
+#include <poll.h>
+#include <signal.h>
+#include <strings.h>
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Caches are usually written in several steps. A cache is only converted
+ * after it didn't change for a short while. The worker threads, lookup
+ * tables and output buffers stay initialized between the conversions.
+ */
+
+#define WATCH_DEBOUNCE_MS	1000
+#define WATCH_EVENTS		(IN_CLOSE_WRITE | IN_MOVED_TO | IN_MODIFY | \
+				 IN_DELETE | IN_MOVED_FROM)
+
+struct watch_pending {
+	char *path;
+	uint64_t deadline;
+};
+
+static struct {
+	struct watch_pending *pending;
+	size_t count;
+	size_t alloc;
+} watch;
+
+static volatile sig_atomic_t watch_stop;
+
+static void watch_signal(int signum __attribute__((unused)))
+{
+	watch_stop = 1;
+}
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000ULL + (uint64_t)ts.tv_nsec / 1000000ULL;
+}
+
+static int cache_name(const char *name)
+{
+	size_t len = strlen(name);
+
+	if (name[0] == '.')
+		return 0;
+
+	return len > 4 && strcasecmp(&name[len - 4], ".dat") == 0;
+}
+
+static ssize_t pending_find(const char *path)
+{
+	size_t i;
+
+	for (i = 0; i < watch.count; i++) {
+		if (strcmp(watch.pending[i].path, path) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+static void pending_remove(size_t i)
+{
+	free(watch.pending[i].path);
+	watch.pending[i] = watch.pending[--watch.count];
+}
+
+static int pending_update(const char *dir, const char *name, uint32_t mask)
+{
+	struct watch_pending *tmp;
+	char *path;
+	ssize_t i;
+	size_t len;
+
+	len = strlen(dir) + 1 + strlen(name) + 1;
+	path = malloc(len);
+	if (!path)
+		return -ENOMEM;
+
+	snprintf(path, len, "%s/%s", dir, name);
+
+	i = pending_find(path);
+	if (mask & (IN_DELETE | IN_MOVED_FROM)) {
+		if (i >= 0)
+			pending_remove(i);
+		free(path);
+		return 0;
+	}
+
+	if (i >= 0) {
+		watch.pending[i].deadline = now_ms() + WATCH_DEBOUNCE_MS;
+		free(path);
+		return 0;
+	}
+
+	if (watch.count == watch.alloc) {
+		watch.alloc = watch.alloc ? watch.alloc * 2 : 16;
+		tmp = realloc(watch.pending, watch.alloc * sizeof(*watch.pending));
+		if (!tmp) {
+			free(path);
+			return -ENOMEM;
+		}
+		watch.pending = tmp;
+	}
+
+	watch.pending[watch.count].path = path;
+	watch.pending[watch.count].deadline = now_ms() + WATCH_DEBOUNCE_MS;
+	watch.count++;
+
+	return 0;
+}
+
+static int read_events(int fd, const char *dir)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *event;
+	ssize_t len;
+	char *pos;
+	int ret;
+
+	while (1) {
+		len = read(fd, buf, sizeof(buf));
+		if (len < 0 && errno == EAGAIN)
+			return 0;
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0) {
+			fprintf(stderr, "Could not read directory events\n");
+			return -EIO;
+		}
+
+		for (pos = buf; pos < buf + len; pos += sizeof(*event) + event->len) {
+			event = (const struct inotify_event *)pos;
+
+			if (event->mask & IN_IGNORED) {
+				fprintf(stderr, "Watched directory %s was removed\n", dir);
+				return -ENOENT;
+			}
+
+			if (!event->len || !cache_name(event->name))
+				continue;
+
+			ret = pending_update(dir, event->name, event->mask);
+			if (ret < 0)
+				return ret;
+		}
+	}
+}
+
+static int convert_pending(watch_convert_t convert)
+{
+	uint64_t now = now_ms();
+	char *path;
+	size_t i = 0;
+	int ret;
+
+	while (i < watch.count && !watch_stop) {
+		if (watch.pending[i].deadline > now) {
+			i++;
+			continue;
+		}
+
+		path = watch.pending[i].path;
+		watch.pending[i].path = NULL;
+		watch.pending[i] = watch.pending[--watch.count];
+
+		if (globals.verbose >= VERBOSITY_GLOBAL_HEADER)
+			fprintf(stderr, "Changed: %s\n", path);
+
+		ret = convert(path);
+		free(path);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int poll_timeout(void)
+{
+	uint64_t now = now_ms();
+	uint64_t next = UINT64_MAX;
+	size_t i;
+
+	for (i = 0; i < watch.count; i++) {
+		if (watch.pending[i].deadline < next)
+			next = watch.pending[i].deadline;
+	}
+
+	if (next == UINT64_MAX)
+		return -1;
+
+	if (next <= now)
+		return 0;
+
+	return (int)(next - now);
+}
+
+int watch_directory(const char *path, watch_convert_t convert)
+{
+	struct sigaction sa;
+	struct pollfd pfd;
+	int fd;
+	int ret;
+
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "Could not initialize directory watch\n");
+		return -errno;
+	}
+
+	if (inotify_add_watch(fd, path, WATCH_EVENTS | IN_ONLYDIR) < 0) {
+		fprintf(stderr, "Could not watch directory %s\n", path);
+		close(fd);
+		return -ENOENT;
+	}
+
+	/* stop cleanly between two conversions */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = watch_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	if (globals.verbose >= VERBOSITY_GLOBAL_HEADER)
+		fprintf(stderr, "Watching: %s\n", path);
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	ret = 0;
+	while (!watch_stop) {
+		ret = poll(&pfd, 1, poll_timeout());
+		if (ret < 0 && errno == EINTR) {
+			ret = 0;
+			continue;
+		}
+		if (ret < 0) {
+			fprintf(stderr, "Could not wait for directory events\n");
+			ret = -errno;
+			break;
+		}
+
+		if (pfd.revents & POLLIN) {
+			ret = read_events(fd, path);
+			if (ret < 0)
+				break;
+		}
+
+		ret = convert_pending(convert);
+		if (ret < 0)
+			break;
+	}
+
+	while (watch.count)
+		pending_remove(watch.count - 1);
+	free(watch.pending);
+	memset(&watch, 0, sizeof(watch));
+
+	close(fd);
+
+	return ret;
+}
+
+#else
+
+int watch_directory(const char *path __attribute__((unused)),
+		    watch_convert_t convert __attribute__((unused)))
+{
+	fprintf(stderr, "Watching directories is not supported on this platform\n");
+	return -EOPNOTSUPP;
+}
+
+#endif
@@ -0,0 +1,324 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* glide64_cache_extract, Glide64 TexCache Extraction tool for debugging
+ *
+ * SPDX-FileCopyrightText: Sven Eckelmann <sven@narfation.org>
+ */
+
+#include "glide64_cache_extract.h"
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+/* The entries are streamed without data descriptors: the crc and the
+ * (compressed) size are calculated by the worker threads before the local
+ * header is written. The central directory is collected in memory and
+ * appended at the end. ZIP64 records are only emitted when the offsets or
+ * the number of entries don't fit in the classic fields.
+ */
+
+#define ZIP_LOCAL_HEADER_SIG	0x04034b50U
+#define ZIP_CENTRAL_HEADER_SIG	0x02014b50U
+#define ZIP64_END_SIG		0x06064b50U
+#define ZIP64_LOCATOR_SIG	0x07064b50U
+#define ZIP_END_SIG		0x06054b50U
+
+#define ZIP_LOCAL_HEADER_LEN	30
+#define ZIP_CENTRAL_HEADER_LEN	46
+#define ZIP64_EXTRA_LEN		12
+#define ZIP64_END_LEN		56
+#define ZIP64_LOCATOR_LEN	20
+#define ZIP_END_LEN		22
+
+#define ZIP_VERSION		20
+#define ZIP64_VERSION		45
+#define ZIP_MADE_BY_UNIX	0x0300U
+
+#define ZIP_METHOD_STORE	0
+#define ZIP_METHOD_DEFLATE	8
+
+/* 1980-01-01 00:00:00, the earliest DOS timestamp */
+#define ZIP_DOS_TIME		0x0000U
+#define ZIP_DOS_DATE		0x0021U
+
+struct zip_entry {
+	char name[100];
+	uint64_t offset;
+	uint32_t crc;
+	uint32_t compressed_size;
+	uint32_t size;
+	uint16_t method;
+};
+
+static struct {
+	struct zip_entry *entries;
+	size_t count;
+	size_t alloc;
+	uint64_t offset;
+} zip;
+
+static uint8_t *put_le16(uint8_t *buf, uint16_t value)
+{
+	buf[0] = value & 0xff;
+	buf[1] = value >> 8;
+
+	return buf + 2;
+}
+
+static uint8_t *put_le32(uint8_t *buf, uint32_t value)
+{
+	buf = put_le16(buf, value & 0xffff);
+	return put_le16(buf, value >> 16);
+}
+
+static uint8_t *put_le64(uint8_t *buf, uint64_t value)
+{
+	buf = put_le32(buf, value & 0xffffffffU);
+	return put_le32(buf, value >> 32);
+}
+
+static int zip_write(const void *buffer, size_t size)
+{
+	int ret;
+
+	ret = output_write(buffer, size);
+	if (ret < 0)
+		return ret;
+
+	zip.offset += size;
+
+	return 0;
+}
+
+int zip_prepare(struct glide64_file *file)
+{
+	z_stream strm;
+	uLong bound;
+	void *buf;
+	int ret;
+
+	file->crc = crc32(crc32(0L, Z_NULL, 0), file->data, file->size);
+	file->zip_method = ZIP_METHOD_STORE;
+	file->zip_size = file->size;
+
+	if (globals.archive != ARCHIVE_ZIP_DEFLATE || !file->size)
+		return 0;
+
+	memset(&strm, 0, sizeof(strm));
+	ret = deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+			   8, Z_DEFAULT_STRATEGY);
+	if (ret != Z_OK) {
+		fprintf(stderr, "Could not initialize compression\n");
+		return -ENOMEM;
+	}
+
+	bound = deflateBound(&strm, file->size);
+	buf = malloc(bound);
+	if (!buf) {
+		deflateEnd(&strm);
+		fprintf(stderr, "Memory for compressing the file couldn't be allocated\n");
+		return -ENOMEM;
+	}
+
+	strm.next_in = file->data;
+	strm.avail_in = file->size;
+	strm.next_out = buf;
+	strm.avail_out = bound;
+
+	ret = deflate(&strm, Z_FINISH);
+	deflateEnd(&strm);
+	if (ret != Z_STREAM_END) {
+		free(buf);
+		fprintf(stderr, "Failure during compressing\n");
+		return -EINVAL;
+	}
+
+	/* incompressible content is stored as is */
+	if (strm.total_out >= file->size) {
+		free(buf);
+		return 0;
+	}
+
+	free(file->data);
+	file->data = buf;
+	file->zip_method = ZIP_METHOD_DEFLATE;
+	file->zip_size = strm.total_out;
+
+	return 0;
+}
+
+int zip_write_file(struct glide64_file *file)
+{
+	uint8_t header[ZIP_LOCAL_HEADER_LEN];
+	struct zip_entry *entry, *tmp;
+	size_t name_len;
+	uint8_t *pos;
+	int ret;
+
+	if (zip.count == zip.alloc) {
+		zip.alloc = zip.alloc ? zip.alloc * 2 : 1024;
+		tmp = realloc(zip.entries, zip.alloc * sizeof(*zip.entries));
+		if (!tmp) {
+			fprintf(stderr, "Could not allocate memory for zip directory\n");
+			return -ENOMEM;
+		}
+		zip.entries = tmp;
+	}
+
+	entry = &zip.entries[zip.count];
+	file_name(file, entry->name, sizeof(entry->name));
+	entry->offset = zip.offset;
+	entry->crc = file->crc;
+	entry->compressed_size = file->zip_size;
+	entry->size = file->size;
+	entry->method = file->zip_method;
+	name_len = strlen(entry->name);
+
+	pos = header;
+	pos = put_le32(pos, ZIP_LOCAL_HEADER_SIG);
+	pos = put_le16(pos, ZIP_VERSION);
+	pos = put_le16(pos, 0);
+	pos = put_le16(pos, entry->method);
+	pos = put_le16(pos, ZIP_DOS_TIME);
+	pos = put_le16(pos, ZIP_DOS_DATE);
+	pos = put_le32(pos, entry->crc);
+	pos = put_le32(pos, entry->compressed_size);
+	pos = put_le32(pos, entry->size);
+	pos = put_le16(pos, name_len);
+	put_le16(pos, 0);
+
+	ret = zip_write(header, sizeof(header));
+	if (ret < 0)
+		goto err;
+
+	ret = zip_write(entry->name, name_len);
+	if (ret < 0)
+		goto err;
+
+	if (entry->compressed_size) {
+		ret = zip_write(file->data, entry->compressed_size);
+		if (ret < 0)
+			goto err;
+	}
+
+	zip.count++;
+
+	return 0;
+
+err:
+	fprintf(stderr, "Failed to write zip entry\n");
+	return ret;
+}
+
+static uint8_t *put_central_header(uint8_t *pos, const struct zip_entry *entry)
+{
+	size_t name_len = strlen(entry->name);
+	int zip64 = entry->offset >= UINT32_MAX;
+
+	pos = put_le32(pos, ZIP_CENTRAL_HEADER_SIG);
+	pos = put_le16(pos, ZIP_MADE_BY_UNIX | ZIP64_VERSION);
+	pos = put_le16(pos, zip64 ? ZIP64_VERSION : ZIP_VERSION);
+	pos = put_le16(pos, 0);
+	pos = put_le16(pos, entry->method);
+	pos = put_le16(pos, ZIP_DOS_TIME);
+	pos = put_le16(pos, ZIP_DOS_DATE);
+	pos = put_le32(pos, entry->crc);
+	pos = put_le32(pos, entry->compressed_size);
+	pos = put_le32(pos, entry->size);
+	pos = put_le16(pos, name_len);
+	pos = put_le16(pos, zip64 ? ZIP64_EXTRA_LEN : 0);
+	pos = put_le16(pos, 0);
+	pos = put_le16(pos, 0);
+	pos = put_le16(pos, 0);
+	pos = put_le32(pos, 0100644U << 16);
+	pos = put_le32(pos, zip64 ? UINT32_MAX : entry->offset);
+
+	memcpy(pos, entry->name, name_len);
+	pos += name_len;
+
+	if (zip64) {
+		pos = put_le16(pos, 0x0001);
+		pos = put_le16(pos, 8);
+		pos = put_le64(pos, entry->offset);
+	}
+
+	return pos;
+}
+
+int zip_finish(void)
+{
+	uint8_t *directory, *pos;
+	uint64_t directory_offset, directory_size, end64_offset;
+	size_t size = ZIP64_END_LEN + ZIP64_LOCATOR_LEN + ZIP_END_LEN;
+	size_t i;
+	int zip64;
+	int ret;
+
+	for (i = 0; i < zip.count; i++)
+		size += ZIP_CENTRAL_HEADER_LEN + ZIP64_EXTRA_LEN + strlen(zip.entries[i].name);
+
+	directory = malloc(size);
+	if (!directory) {
+		fprintf(stderr, "Could not allocate memory for zip directory\n");
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	pos = directory;
+	for (i = 0; i < zip.count; i++)
+		pos = put_central_header(pos, &zip.entries[i]);
+
+	directory_offset = zip.offset;
+	directory_size = pos - directory;
+	end64_offset = directory_offset + directory_size;
+	zip64 = zip.count >= UINT16_MAX || directory_offset >= UINT32_MAX ||
+		directory_size >= UINT32_MAX;
+
+	if (zip64) {
+		pos = put_le32(pos, ZIP64_END_SIG);
+		pos = put_le64(pos, ZIP64_END_LEN - 12);
+		pos = put_le16(pos, ZIP_MADE_BY_UNIX | ZIP64_VERSION);
+		pos = put_le16(pos, ZIP64_VERSION);
+		pos = put_le32(pos, 0);
+		pos = put_le32(pos, 0);
+		pos = put_le64(pos, zip.count);
+		pos = put_le64(pos, zip.count);
+		pos = put_le64(pos, directory_size);
+		pos = put_le64(pos, directory_offset);
+
+		pos = put_le32(pos, ZIP64_LOCATOR_SIG);
+		pos = put_le32(pos, 0);
+		pos = put_le64(pos, end64_offset);
+		pos = put_le32(pos, 1);
+	}
+
+	pos = put_le32(pos, ZIP_END_SIG);
+	pos = put_le16(pos, 0);
+	pos = put_le16(pos, 0);
+	pos = put_le16(pos, zip64 ? UINT16_MAX : zip.count);
+	pos = put_le16(pos, zip64 ? UINT16_MAX : zip.count);
+	pos = put_le32(pos, zip64 ? UINT32_MAX : directory_size);
+	pos = put_le32(pos, zip64 ? UINT32_MAX : directory_offset);
+	pos = put_le16(pos, 0);
+
+	ret = zip_write(directory, pos - directory);
+	free(directory);
+	if (ret < 0)
+		fprintf(stderr, "Failed to write zip directory\n");
+
+out:
+	free(zip.entries);
+	memset(&zip, 0, sizeof(zip));
+
+	return ret;
+}
+
+/* drop the entries of an archive which is not completed */
+void zip_abort(void)
+{
+	free(zip.entries);
+	memset(&zip, 0, sizeof(zip));
+}